@@ -0,0 +1,100 @@
+/*
+ * Measures how many trivial jobs per second GbJobQueue gets through at a
+ * few concurrency limits. Every job runs /bin/true, so the numbers are
+ * dominated by spawning, reaping and bookkeeping.
+ */
+
+#include "gb-job-queue.h"
+
+#define N_JOBS 5000
+
+static GMainLoop *gMainLoop;
+static guint gFailed;
+
+static void
+job_finished (GbJobQueue *queue,
+              guint       job_id,
+              gint        status,
+              gint64      queued_usec,
+              gint64      run_usec,
+              gpointer    user_data)
+{
+  if (status != 0)
+    gFailed++;
+
+  if (!gb_job_queue_get_n_pending (queue) &&
+      !gb_job_queue_get_n_running (queue))
+    g_main_loop_quit (gMainLoop);
+}
+
+static gdouble
+run_round (GbSupervisor *supervisor,
+           guint         max_running)
+{
+  static const gchar *argv[] = { "/bin/true", NULL };
+  GbJobQueue *queue;
+  gint64 begin;
+  gint64 end;
+  guint i;
+
+  queue = gb_job_queue_new (supervisor);
+  gb_job_queue_set_max_running (queue, max_running);
+  g_signal_connect (queue, "job-finished", G_CALLBACK (job_finished), NULL);
+
+  begin = g_get_monotonic_time ();
+
+  for (i = 0; i < N_JOBS; i++)
+    gb_job_queue_submit (queue, argv, 0);
+
+  g_main_loop_run (gMainLoop);
+
+  end = g_get_monotonic_time ();
+
+  g_object_unref (queue);
+
+  return (gdouble)(end - begin) / G_USEC_PER_SEC;
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  GbSupervisor *supervisor;
+  GError *error = NULL;
+  gdouble elapsed;
+  guint n_cpus;
+  guint limits[4];
+  guint i;
+
+  supervisor = gb_supervisor_new ();
+
+  if (!gb_supervisor_run (supervisor, &error))
+    {
+      g_error ("%s", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  gMainLoop = g_main_loop_new (NULL, FALSE);
+
+  n_cpus = g_get_num_processors ();
+  limits[0] = 1;
+  limits[1] = MAX (1, n_cpus / 2);
+  limits[2] = n_cpus;
+  limits[3] = n_cpus * 4;
+
+  for (i = 0; i < G_N_ELEMENTS (limits); i++)
+    {
+      gFailed = 0;
+      elapsed = run_round (supervisor, limits[i]);
+      g_print ("max-running %u: %.0f jobs/s (%u failed)\n",
+               limits[i], N_JOBS / elapsed, gFailed);
+    }
+
+  gb_supervisor_shutdown (supervisor);
+
+  g_main_loop_unref (gMainLoop);
+  g_object_unref (supervisor);
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Measures how fast the shards work through child churn as their number
+ * grows.
+ *
+ * A batch of pids is registered and most of them are then reported as
+ * exited, the way the supervisor reports the exits of its own children.
+ * Commands go out with gb_supervisor_add_pids() and
+ * gb_supervisor_remove_pids(), a few large writes per shard, so the
+ * single-threaded parent is cheap next to the shards parsing and
+ * updating their tables. Once a shard falls behind, its pipe fills and
+ * the parent waits on it, so producing is bounded by the slowest shard
+ * too. Producing and draining are timed separately: drain time is what
+ * the shards still need after the last command was written, until every
+ * shard has worked through its channel and reaped the rest.
+ *
+ * Spawning real children is left out on purpose. The parent forks them
+ * one at a time, and that would cap the rate at the same value for any
+ * number of shards.
+ *
+ * The pids are above PID_MAX_LIMIT so they can never belong to a real
+ * process and the final SIGTERMs are harmless. Run with 2>/dev/null to
+ * keep the "Reaping" lines out of the way.
+ */
+
+#include "gb-supervisor.h"
+
+#define N_PIDS     200000
+#define N_COMMANDS (N_PIDS * 2 - N_PIDS / 100)
+#define BATCH      4096
+#define MAX_SHARDS 8
+#define PID_BASE   5000000
+
+static void
+run_churn (guint    n_shards,
+           GPid    *pids,
+           GPid    *exited,
+           guint    n_exited,
+           gdouble *produce_sec,
+           gdouble *drain_sec)
+{
+  GbSupervisor *supervisor;
+  GError *error = NULL;
+  gint64 begin;
+  gint64 produced;
+  gint64 end;
+  guint i;
+
+  supervisor = gb_supervisor_new ();
+  gb_supervisor_set_shards (supervisor, n_shards);
+
+  if (!gb_supervisor_run (supervisor, &error))
+    g_error ("%s", error->message);
+
+  begin = g_get_monotonic_time ();
+
+  for (i = 0; i < N_PIDS; i += BATCH)
+    gb_supervisor_add_pids (supervisor, pids + i, MIN (BATCH, N_PIDS - i));
+
+  for (i = 0; i < n_exited; i += BATCH)
+    gb_supervisor_remove_pids (supervisor, exited + i, MIN (BATCH, n_exited - i));
+
+  produced = g_get_monotonic_time ();
+
+  gb_supervisor_shutdown (supervisor);
+
+  end = g_get_monotonic_time ();
+
+  g_object_unref (supervisor);
+
+  *produce_sec = (gdouble)(produced - begin) / G_USEC_PER_SEC;
+  *drain_sec = (gdouble)(end - produced) / G_USEC_PER_SEC;
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  gdouble produce_sec;
+  gdouble drain_sec;
+  guint n_shards;
+  guint n_exited = 0;
+  GPid *exited;
+  GPid *pids;
+  guint i;
+
+  pids = g_new (GPid, N_PIDS);
+  exited = g_new (GPid, N_PIDS);
+
+  /*
+   * One in a hundred children is still running at the end.
+   */
+  for (i = 0; i < N_PIDS; i++)
+    {
+      pids[i] = PID_BASE + i;
+
+      if (i % 100)
+        exited[n_exited++] = pids[i];
+    }
+
+  for (n_shards = 1; n_shards <= MAX_SHARDS; n_shards *= 2)
+    {
+      run_churn (n_shards, pids, exited, n_exited, &produce_sec, &drain_sec);
+
+      g_print ("%u shard(s): produce %.3f s, drain %.3f s, %.0f commands/s\n",
+               n_shards,
+               produce_sec,
+               drain_sec,
+               N_COMMANDS / (produce_sec + drain_sec));
+    }
+
+  g_free (exited);
+  g_free (pids);
+
+  return 0;
+}
@@ -0,0 +1,434 @@
+/* gb-cgroup.c
+ *
+ * Copyright (C) 2013 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gb-cgroup.h"
+
+#define CGROUP_MOUNT "/sys/fs/cgroup"
+
+/*
+ * cgroup.kill is asynchronous. Check this often, and this many times,
+ * whether the kernel is done tearing down the processes.
+ */
+#define REMOVE_ATTEMPTS 500
+#define REMOVE_INTERVAL 10 /* msec */
+
+typedef struct
+{
+  gchar *cgroup;
+  guint  attempts;
+} GbCgroupRemoval;
+
+/*
+ * Returns the cgroup2 directory this process lives in, or NULL if the
+ * unified hierarchy is not in use.
+ */
+gchar *
+gb_cgroup_get_self (void)
+{
+  gchar *contents;
+  gchar **lines;
+  gchar *ret = NULL;
+  guint i;
+
+  if (!g_file_get_contents ("/proc/self/cgroup", &contents, NULL, NULL))
+    return NULL;
+
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (i = 0; lines[i]; i++)
+    {
+      if (g_str_has_prefix (lines[i], "0::"))
+        {
+          ret = g_build_filename (CGROUP_MOUNT, lines[i] + 3, NULL);
+          break;
+        }
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return ret;
+}
+
+gboolean
+gb_cgroup_write (const gchar  *cgroup,
+                 const gchar  *file,
+                 const gchar  *value,
+                 GError      **error)
+{
+  gchar *path;
+  gssize len;
+  gint fd;
+
+  g_return_val_if_fail (cgroup, FALSE);
+  g_return_val_if_fail (file, FALSE);
+  g_return_val_if_fail (value, FALSE);
+
+  /*
+   * cgroupfs does not support the rename dance g_file_set_contents()
+   * performs, so write to the control file in place.
+   */
+  path = g_build_filename (cgroup, file, NULL);
+  fd = open (path, O_WRONLY | O_CLOEXEC);
+
+  if (fd == -1)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   g_file_error_from_errno (errno),
+                   "%s: %s", path, g_strerror (errno));
+      g_free (path);
+      return FALSE;
+    }
+
+  len = strlen (value);
+
+  if (write (fd, value, len) != len)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   g_file_error_from_errno (errno),
+                   "%s: %s", path, g_strerror (errno));
+      g_free (path);
+      close (fd);
+      return FALSE;
+    }
+
+  g_free (path);
+  close (fd);
+
+  return TRUE;
+}
+
+/*
+ * Opens cgroup.procs of @cgroup for writing. Writing "0" to the result
+ * moves the writer itself, which a child can do between fork and exec.
+ */
+gint
+gb_cgroup_open_procs (const gchar  *cgroup,
+                      GError      **error)
+{
+  gchar *path;
+  gint fd;
+
+  g_return_val_if_fail (cgroup, -1);
+
+  path = g_build_filename (cgroup, "cgroup.procs", NULL);
+  fd = open (path, O_WRONLY | O_CLOEXEC);
+
+  if (fd == -1)
+    g_set_error (error,
+                 G_FILE_ERROR,
+                 g_file_error_from_errno (errno),
+                 "%s: %s", path, g_strerror (errno));
+
+  g_free (path);
+
+  return fd;
+}
+
+gboolean
+gb_cgroup_attach (const gchar  *cgroup,
+                  GPid          pid,
+                  GError      **error)
+{
+  gchar str[16];
+
+  g_snprintf (str, sizeof str, "%u", (guint)pid);
+
+  return gb_cgroup_write (cgroup, "cgroup.procs", str, error);
+}
+
+/*
+ * Returns TRUE if @pid is this process or one of its children.
+ */
+static gboolean
+gb_cgroup_is_own (const gchar *pid)
+{
+  gchar *contents = NULL;
+  gchar *path;
+  gchar *end;
+  gboolean ret = FALSE;
+  gint ppid;
+
+  if (g_ascii_strtoull (pid, NULL, 10) == (guint64)getpid ())
+    return TRUE;
+
+  path = g_build_filename ("/proc", pid, "stat", NULL);
+  g_file_get_contents (path, &contents, NULL, NULL);
+  g_free (path);
+
+  /*
+   * The command name may contain anything, so look for the state and
+   * parent after its closing parenthesis.
+   */
+  if (contents && (end = strrchr (contents, ')')) &&
+      sscanf (end + 1, " %*c %d", &ppid) == 1)
+    ret = (ppid == getpid ());
+
+  g_free (contents);
+
+  return ret;
+}
+
+/*
+ * cgroup2 only lets a group hand controllers to its children once it has
+ * no processes of its own. Move everything living in @root into a leaf
+ * named "supervisor" and then enable the memory and cpu controllers for
+ * the groups we create next to it.
+ *
+ * This is refused if @root holds processes other than ours and our
+ * children, since moving them would change limits someone else set. If
+ * enabling the controllers fails, the processes are moved back and the
+ * leaf is removed again.
+ */
+gboolean
+gb_cgroup_delegate (const gchar  *root,
+                    GError      **error)
+{
+  gchar *contents = NULL;
+  gchar **pids = NULL;
+  gchar *leaf;
+  gchar *path;
+  gboolean created;
+  gboolean ret = FALSE;
+  guint moved = 0;
+  guint i;
+
+  g_return_val_if_fail (root, FALSE);
+
+  path = g_build_filename (root, "cgroup.procs", NULL);
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    {
+      g_free (path);
+      return FALSE;
+    }
+
+  g_free (path);
+
+  pids = g_strsplit (contents, "\n", 0);
+
+  for (i = 0; pids[i]; i++)
+    {
+      if (*pids[i] && !gb_cgroup_is_own (pids[i]))
+        {
+          g_set_error (error,
+                       G_FILE_ERROR,
+                       G_FILE_ERROR_PERM,
+                       "%s: process %s is not ours, refusing to move it",
+                       root, pids[i]);
+          g_strfreev (pids);
+          g_free (contents);
+          return FALSE;
+        }
+    }
+
+  leaf = g_build_filename (root, "supervisor", NULL);
+  created = (g_mkdir (leaf, 0755) == 0);
+
+  if (!created && errno != EEXIST)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   g_file_error_from_errno (errno),
+                   "%s: %s", leaf, g_strerror (errno));
+      goto cleanup;
+    }
+
+  for (moved = 0; pids[moved]; moved++)
+    {
+      if (*pids[moved] &&
+          !gb_cgroup_write (leaf, "cgroup.procs", pids[moved], error))
+        goto rollback;
+    }
+
+  if (gb_cgroup_write (root, "cgroup.subtree_control", "+memory +cpu", error))
+    {
+      ret = TRUE;
+      goto cleanup;
+    }
+
+rollback:
+  /*
+   * Processes that exited in the meantime fail to move back, which is
+   * fine; anything still in the leaf keeps it from being removed.
+   */
+  for (i = 0; i < moved; i++)
+    {
+      if (*pids[i])
+        gb_cgroup_write (root, "cgroup.procs", pids[i], NULL);
+    }
+
+  if (created)
+    g_rmdir (leaf);
+
+cleanup:
+  g_strfreev (pids);
+  g_free (contents);
+  g_free (leaf);
+
+  return ret;
+}
+
+gchar *
+gb_cgroup_create (const gchar  *root,
+                  const gchar  *name,
+                  GError      **error)
+{
+  gchar *path;
+
+  g_return_val_if_fail (root, NULL);
+  g_return_val_if_fail (name, NULL);
+
+  path = g_build_filename (root, name, NULL);
+
+  if (g_mkdir (path, 0755) != 0 && errno != EEXIST)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   g_file_error_from_errno (errno),
+                   "%s: %s", path, g_strerror (errno));
+      g_free (path);
+      return NULL;
+    }
+
+  return path;
+}
+
+/*
+ * Reads the counter named @key from a flat keyed file such as
+ * memory.events.
+ */
+guint64
+gb_cgroup_read_event (const gchar *cgroup,
+                      const gchar *file,
+                      const gchar *key)
+{
+  gchar *contents = NULL;
+  gchar **lines;
+  gchar *path;
+  guint64 ret = 0;
+  gsize len;
+  guint i;
+
+  g_return_val_if_fail (cgroup, 0);
+  g_return_val_if_fail (file, 0);
+  g_return_val_if_fail (key, 0);
+
+  path = g_build_filename (cgroup, file, NULL);
+  g_file_get_contents (path, &contents, NULL, NULL);
+  g_free (path);
+
+  if (!contents)
+    return 0;
+
+  len = strlen (key);
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (i = 0; lines[i]; i++)
+    {
+      if (!strncmp (lines[i], key, len) && lines[i][len] == ' ')
+        {
+          ret = g_ascii_strtoull (lines[i] + len + 1, NULL, 10);
+          break;
+        }
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return ret;
+}
+
+static void
+gb_cgroup_removal_free (gpointer data)
+{
+  GbCgroupRemoval *removal = data;
+
+  g_free (removal->cgroup);
+  g_free (removal);
+}
+
+/*
+ * Removes the group once the kernel reports it empty. Returns TRUE if
+ * it should be tried again later.
+ */
+static gboolean
+gb_cgroup_try_remove (GbCgroupRemoval *removal)
+{
+  gint err = EBUSY;
+
+  if (!gb_cgroup_read_event (removal->cgroup, "cgroup.events", "populated"))
+    {
+      if (g_rmdir (removal->cgroup) == 0 || errno == ENOENT)
+        return FALSE;
+
+      err = errno;
+    }
+
+  if (err == EBUSY && ++removal->attempts < REMOVE_ATTEMPTS)
+    return TRUE;
+
+  g_warning ("Failed to remove %s: %s", removal->cgroup, g_strerror (err));
+
+  return FALSE;
+}
+
+static gboolean
+gb_cgroup_remove_cb (gpointer data)
+{
+  return gb_cgroup_try_remove (data) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/*
+ * Kills anything left behind in @cgroup and removes it once the kernel
+ * reports it empty. The group is polled from the main loop, so this
+ * returns right away.
+ */
+void
+gb_cgroup_remove (const gchar *cgroup)
+{
+  GbCgroupRemoval *removal;
+
+  g_return_if_fail (cgroup);
+
+  gb_cgroup_write (cgroup, "cgroup.kill", "1", NULL);
+
+  removal = g_new0 (GbCgroupRemoval, 1);
+  removal->cgroup = g_strdup (cgroup);
+
+  if (!gb_cgroup_try_remove (removal))
+    {
+      gb_cgroup_removal_free (removal);
+      return;
+    }
+
+  g_timeout_add_full (G_PRIORITY_DEFAULT,
+                      REMOVE_INTERVAL,
+                      gb_cgroup_remove_cb,
+                      removal,
+                      gb_cgroup_removal_free);
+}
@@ -0,0 +1,48 @@
+/* gb-cgroup.h
+ *
+ * Copyright (C) 2013 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GB_CGROUP_H
+#define GB_CGROUP_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gchar    *gb_cgroup_get_self   (void);
+gboolean  gb_cgroup_delegate   (const gchar  *root,
+                                GError      **error);
+gchar    *gb_cgroup_create     (const gchar  *root,
+                                const gchar  *name,
+                                GError      **error);
+gboolean  gb_cgroup_write      (const gchar  *cgroup,
+                                const gchar  *file,
+                                const gchar  *value,
+                                GError      **error);
+gboolean  gb_cgroup_attach     (const gchar  *cgroup,
+                                GPid          pid,
+                                GError      **error);
+gint      gb_cgroup_open_procs (const gchar  *cgroup,
+                                GError      **error);
+guint64   gb_cgroup_read_event (const gchar  *cgroup,
+                                const gchar  *file,
+                                const gchar  *key);
+void      gb_cgroup_remove     (const gchar  *cgroup);
+
+G_END_DECLS
+
+#endif /* GB_CGROUP_H */
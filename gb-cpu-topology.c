@@ -0,0 +1,383 @@
+/* gb-cpu-topology.c
+ *
+ * Copyright (C) 2013 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdio.h>
+
+#include "gb-cpu-topology.h"
+
+#define SYSFS_CPU  "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+struct _GbCpuTopology
+{
+  GArray    *cpus;  /* Online cpus, one thread per core first. */
+  GPtrArray *l3;    /* GArray of cpus for each L3 cache domain. */
+  GPtrArray *nodes; /* GArray of cpus for each NUMA node. */
+};
+
+static gchar *
+read_sysfs (const gchar *path)
+{
+  gchar *contents = NULL;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return NULL;
+
+  return g_strstrip (contents);
+}
+
+static GArray *
+read_sysfs_list (const gchar *path)
+{
+  GArray *ret;
+  gchar *contents;
+
+  if (!(contents = read_sysfs (path)))
+    return NULL;
+
+  ret = gb_cpu_topology_parse_list (contents);
+  g_free (contents);
+
+  return ret;
+}
+
+/*
+ * Parses a kernel cpulist such as "0-3,8,10-11". CPUs that do not fit in
+ * a cpu_set_t are dropped, as are reversed ranges.
+ */
+GArray *
+gb_cpu_topology_parse_list (const gchar *list)
+{
+  GArray *ret;
+  gchar **parts;
+  guint first;
+  guint last;
+  guint i;
+  guint j;
+
+  g_return_val_if_fail (list, NULL);
+
+  ret = g_array_new (FALSE, FALSE, sizeof (guint));
+  parts = g_strsplit (list, ",", 0);
+
+  for (i = 0; parts[i]; i++)
+    {
+      g_strstrip (parts[i]);
+
+      if (!*parts[i])
+        continue;
+
+      if (2 != sscanf (parts[i], "%u-%u", &first, &last))
+        {
+          if (1 != sscanf (parts[i], "%u", &first))
+            continue;
+          last = first;
+        }
+
+      last = MIN (last, CPU_SETSIZE - 1);
+
+      if (first > last)
+        continue;
+
+      for (j = first; j <= last; j++)
+        g_array_append_val (ret, j);
+    }
+
+  g_strfreev (parts);
+
+  return ret;
+}
+
+static gboolean
+is_first_sibling (guint cpu)
+{
+  GArray *siblings;
+  gboolean ret = TRUE;
+  gchar *path;
+
+  path = g_strdup_printf (SYSFS_CPU "/cpu%u/topology/thread_siblings_list",
+                          cpu);
+  siblings = read_sysfs_list (path);
+  g_free (path);
+
+  if (siblings && siblings->len)
+    ret = (g_array_index (siblings, guint, 0) == cpu);
+
+  if (siblings)
+    g_array_unref (siblings);
+
+  return ret;
+}
+
+static void
+load_cpus (GbCpuTopology *topology)
+{
+  GArray *online;
+  GArray *secondary;
+  guint cpu;
+  guint i;
+
+  if (!(online = read_sysfs_list (SYSFS_CPU "/online")))
+    {
+      online = g_array_new (FALSE, FALSE, sizeof (guint));
+      for (i = 0; i < g_get_num_processors (); i++)
+        g_array_append_val (online, i);
+    }
+
+  /*
+   * Hand out a thread on every physical core before doubling up on
+   * hyper-thread siblings, which share the same L1 and L2.
+   */
+  secondary = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (i = 0; i < online->len; i++)
+    {
+      cpu = g_array_index (online, guint, i);
+
+      if (is_first_sibling (cpu))
+        g_array_append_val (topology->cpus, cpu);
+      else
+        g_array_append_val (secondary, cpu);
+    }
+
+  g_array_append_vals (topology->cpus, secondary->data, secondary->len);
+
+  g_array_unref (secondary);
+  g_array_unref (online);
+}
+
+static void
+load_l3 (GbCpuTopology *topology)
+{
+  GHashTable *seen;
+  GArray *domain;
+  gchar *level;
+  gchar *path;
+  gchar *shared;
+  guint cpu;
+  guint i;
+  guint j;
+
+  seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < topology->cpus->len; i++)
+    {
+      cpu = g_array_index (topology->cpus, guint, i);
+
+      for (j = 0; ; j++)
+        {
+          path = g_strdup_printf (SYSFS_CPU "/cpu%u/cache/index%u/level",
+                                  cpu, j);
+          level = read_sysfs (path);
+          g_free (path);
+
+          if (!level)
+            break;
+
+          if (g_strcmp0 (level, "3") != 0)
+            {
+              g_free (level);
+              continue;
+            }
+
+          g_free (level);
+
+          path = g_strdup_printf (SYSFS_CPU "/cpu%u/cache/index%u/shared_cpu_list",
+                                  cpu, j);
+          shared = read_sysfs (path);
+          g_free (path);
+
+          if (!shared)
+            break;
+
+          if (g_hash_table_contains (seen, shared))
+            {
+              g_free (shared);
+              break;
+            }
+
+          domain = gb_cpu_topology_parse_list (shared);
+          g_hash_table_add (seen, shared);
+          g_ptr_array_add (topology->l3, domain);
+
+          break;
+        }
+    }
+
+  g_hash_table_unref (seen);
+}
+
+static void
+load_nodes (GbCpuTopology *topology)
+{
+  GArray *online;
+  GArray *cpus;
+  gchar *path;
+  guint node;
+  guint i;
+
+  if (!(online = read_sysfs_list (SYSFS_NODE "/online")))
+    return;
+
+  for (i = 0; i < online->len; i++)
+    {
+      node = g_array_index (online, guint, i);
+
+      path = g_strdup_printf (SYSFS_NODE "/node%u/cpulist", node);
+      cpus = read_sysfs_list (path);
+      g_free (path);
+
+      /*
+       * Memory-only nodes have no cpus to place anything on.
+       */
+      if (cpus && cpus->len)
+        g_ptr_array_add (topology->nodes, cpus);
+      else if (cpus)
+        g_array_unref (cpus);
+    }
+
+  g_array_unref (online);
+}
+
+GbCpuTopology *
+gb_cpu_topology_new (void)
+{
+  GbCpuTopology *topology;
+
+  topology = g_slice_new0 (GbCpuTopology);
+  topology->cpus = g_array_new (FALSE, FALSE, sizeof (guint));
+  topology->l3 = g_ptr_array_new_with_free_func ((GDestroyNotify)g_array_unref);
+  topology->nodes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_array_unref);
+
+  load_cpus (topology);
+  load_l3 (topology);
+  load_nodes (topology);
+
+  return topology;
+}
+
+void
+gb_cpu_topology_free (GbCpuTopology *topology)
+{
+  if (topology)
+    {
+      g_array_unref (topology->cpus);
+      g_ptr_array_unref (topology->l3);
+      g_ptr_array_unref (topology->nodes);
+      g_slice_free (GbCpuTopology, topology);
+    }
+}
+
+guint
+gb_cpu_topology_get_n_cpus (GbCpuTopology *topology)
+{
+  g_return_val_if_fail (topology, 0);
+
+  return topology->cpus->len;
+}
+
+static GArray *
+copy_cpus (GArray *cpus)
+{
+  GArray *ret;
+
+  ret = g_array_sized_new (FALSE, FALSE, sizeof (guint), cpus->len);
+  g_array_append_vals (ret, cpus->data, cpus->len);
+
+  return ret;
+}
+
+/*
+ * Returns the single cpu for the slot'th worker placed round-robin.
+ */
+GArray *
+gb_cpu_topology_get_cpu (GbCpuTopology *topology,
+                         guint          slot)
+{
+  GArray *ret;
+  guint cpu;
+
+  g_return_val_if_fail (topology, NULL);
+
+  ret = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  if (topology->cpus->len)
+    {
+      cpu = g_array_index (topology->cpus, guint, slot % topology->cpus->len);
+      g_array_append_val (ret, cpu);
+    }
+
+  return ret;
+}
+
+/*
+ * Returns the L3 domain for the slot'th worker. Domains are filled with
+ * one worker per cpu before moving on to the next domain.
+ */
+GArray *
+gb_cpu_topology_get_l3 (GbCpuTopology *topology,
+                        guint          slot)
+{
+  GArray *domain;
+  guint total = 0;
+  guint i;
+
+  g_return_val_if_fail (topology, NULL);
+
+  for (i = 0; i < topology->l3->len; i++)
+    total += ((GArray *)g_ptr_array_index (topology->l3, i))->len;
+
+  if (!total)
+    return copy_cpus (topology->cpus);
+
+  slot %= total;
+
+  for (i = 0; i < topology->l3->len; i++)
+    {
+      domain = g_ptr_array_index (topology->l3, i);
+
+      if (slot < domain->len)
+        return copy_cpus (domain);
+
+      slot -= domain->len;
+    }
+
+  g_assert_not_reached ();
+
+  return NULL;
+}
+
+/*
+ * Returns the cpus of the NUMA node for the slot'th worker. Consecutive
+ * workers land on different nodes.
+ */
+GArray *
+gb_cpu_topology_get_node (GbCpuTopology *topology,
+                          guint          slot)
+{
+  g_return_val_if_fail (topology, NULL);
+
+  if (!topology->nodes->len)
+    return copy_cpus (topology->cpus);
+
+  return copy_cpus (g_ptr_array_index (topology->nodes,
+                                       slot % topology->nodes->len));
+}
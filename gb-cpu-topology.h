@@ -0,0 +1,41 @@
+/* gb-cpu-topology.h
+ *
+ * Copyright (C) 2013 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GB_CPU_TOPOLOGY_H
+#define GB_CPU_TOPOLOGY_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GbCpuTopology GbCpuTopology;
+
+GbCpuTopology *gb_cpu_topology_new        (void);
+void           gb_cpu_topology_free       (GbCpuTopology *topology);
+guint          gb_cpu_topology_get_n_cpus (GbCpuTopology *topology);
+GArray        *gb_cpu_topology_get_cpu    (GbCpuTopology *topology,
+                                           guint          slot);
+GArray        *gb_cpu_topology_get_l3     (GbCpuTopology *topology,
+                                           guint          slot);
+GArray        *gb_cpu_topology_get_node   (GbCpuTopology *topology,
+                                           guint          slot);
+GArray        *gb_cpu_topology_parse_list (const gchar   *list);
+
+G_END_DECLS
+
+#endif /* GB_CPU_TOPOLOGY_H */
@@ -20,15 +20,50 @@
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 #include <gio/gunixinputstream.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "gb-dbus-daemon.h"
 
+#define TRAFFIC_SLOTS 256
+#define TRAFFIC_PROBE 16
+#define PENDING_SLOTS 1024
+#define PENDING_PROBE 8
+
+typedef struct
+{
+  gchar   *sender;
+  gchar   *interface;
+  guint64  n_messages;
+  guint64  n_bytes;
+  guint64  n_replies;
+  guint64  latency;
+} GbTrafficEntry;
+
+typedef struct
+{
+  gchar   *caller;
+  guint32  serial;
+  gint64   begin;
+  gchar   *interface;
+} GbPendingCall;
+
+typedef struct
+{
+  GMutex          mutex;
+  GbTrafficEntry  entries[TRAFFIC_SLOTS];
+  GbTrafficEntry  overflow;
+  GbPendingCall   pending[PENDING_SLOTS];
+} GbTraffic;
+
 struct _GbDbusDaemonPrivate
 {
   gchar           *address;
   gchar           *config_file;
   GDBusConnection *connection;
+  GDBusConnection *monitor;
+  GbTraffic       *traffic;
   GSubprocess     *subprocess;
 };
 
@@ -114,7 +149,7 @@ gb_dbus_daemon_launch (GbDbusDaemon  *daemon,
   GSubprocess *subprocess;
   gchar *config_file;
 
-  g_return_if_fail (GB_IS_DBUS_DAEMON(daemon));
+  g_return_val_if_fail (GB_IS_DBUS_DAEMON(daemon), NULL);
 
   if (!(config_file = write_config ()))
     {
@@ -172,6 +207,203 @@ cleanup:
   return ret;
 }
 
+static void
+gb_traffic_free (GbTraffic *traffic)
+{
+  guint i;
+
+  for (i = 0; i < TRAFFIC_SLOTS; i++)
+    {
+      g_free (traffic->entries[i].sender);
+      g_free (traffic->entries[i].interface);
+    }
+
+  for (i = 0; i < PENDING_SLOTS; i++)
+    {
+      g_free (traffic->pending[i].caller);
+      g_free (traffic->pending[i].interface);
+    }
+
+  g_mutex_clear (&traffic->mutex);
+  g_free (traffic);
+}
+
+/*
+ * Finds the entry for @sender and @interface with linear probing. When
+ * the neighbourhood is full, the quietest pair in it is folded into a
+ * shared overflow entry and its slot reused, so peers that went away
+ * make room for new ones while memory stays bounded.
+ */
+static GbTrafficEntry *
+gb_traffic_lookup (GbTraffic   *traffic,
+                   const gchar *sender,
+                   const gchar *interface)
+{
+  GbTrafficEntry *entry;
+  GbTrafficEntry *victim = NULL;
+  guint hash;
+  guint i;
+
+  hash = g_str_hash (sender) * 31 + g_str_hash (interface);
+
+  for (i = 0; i < TRAFFIC_PROBE; i++)
+    {
+      entry = &traffic->entries[(hash + i) % TRAFFIC_SLOTS];
+
+      if (!entry->sender)
+        {
+          entry->sender = g_strdup (sender);
+          entry->interface = g_strdup (interface);
+          return entry;
+        }
+
+      if (!strcmp (entry->sender, sender) &&
+          !strcmp (entry->interface, interface))
+        return entry;
+
+      if (!victim || entry->n_messages < victim->n_messages)
+        victim = entry;
+    }
+
+  traffic->overflow.n_messages += victim->n_messages;
+  traffic->overflow.n_bytes += victim->n_bytes;
+  traffic->overflow.n_replies += victim->n_replies;
+  traffic->overflow.latency += victim->latency;
+
+  g_free (victim->sender);
+  g_free (victim->interface);
+  memset (victim, 0, sizeof *victim);
+  victim->sender = g_strdup (sender);
+  victim->interface = g_strdup (interface);
+
+  return victim;
+}
+
+static GbPendingCall *
+gb_traffic_find_pending (GbTraffic   *traffic,
+                         const gchar *caller,
+                         guint32      serial,
+                         gboolean     create)
+{
+  GbPendingCall *pending;
+  guint hash;
+  guint i;
+
+  hash = g_str_hash (caller);
+
+  for (i = 0; i < PENDING_PROBE; i++)
+    {
+      pending = &traffic->pending[((hash ^ serial) + i) % PENDING_SLOTS];
+
+      if (create && !pending->serial)
+        return pending;
+
+      if (pending->serial == serial && !g_strcmp0 (pending->caller, caller))
+        return pending;
+    }
+
+  /*
+   * Calls that never got a reply are overwritten once their
+   * neighbourhood fills up.
+   */
+  if (create)
+    return &traffic->pending[(hash ^ serial) % PENDING_SLOTS];
+
+  return NULL;
+}
+
+static gint
+compare_traffic (gconstpointer a,
+                 gconstpointer b)
+{
+  const GbTrafficEntry *entry_a = a;
+  const GbTrafficEntry *entry_b = b;
+
+  if (entry_a->n_messages != entry_b->n_messages)
+    return (entry_a->n_messages < entry_b->n_messages) ? 1 : -1;
+
+  return 0;
+}
+
+static GDBusMessage *
+monitor_filter (GDBusConnection *connection,
+                GDBusMessage    *message,
+                gboolean         incoming,
+                gpointer         user_data)
+{
+  GbTraffic *traffic = user_data;
+  GbTrafficEntry *entry;
+  GbPendingCall *pending;
+  GDBusMessageType type;
+  const gchar *sender;
+  const gchar *interface;
+  GVariant *body;
+  guint64 size = 0;
+
+  if (!incoming)
+    return message;
+
+  type = g_dbus_message_get_message_type (message);
+  sender = g_dbus_message_get_sender (message);
+  interface = g_dbus_message_get_interface (message);
+
+  if ((body = g_dbus_message_get_body (message)))
+    size = g_variant_get_size (body);
+
+  g_mutex_lock (&traffic->mutex);
+
+  entry = gb_traffic_lookup (traffic,
+                             sender ? sender : "",
+                             interface ? interface : "");
+  entry->n_messages++;
+  entry->n_bytes += size;
+
+  if (type == G_DBUS_MESSAGE_TYPE_METHOD_CALL && sender)
+    {
+      pending = gb_traffic_find_pending (traffic,
+                                         sender,
+                                         g_dbus_message_get_serial (message),
+                                         TRUE);
+      g_free (pending->caller);
+      pending->caller = g_strdup (sender);
+      pending->serial = g_dbus_message_get_serial (message);
+      pending->begin = g_get_monotonic_time ();
+      g_free (pending->interface);
+      pending->interface = g_strdup (interface ? interface : "");
+    }
+  else if ((type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN ||
+            type == G_DBUS_MESSAGE_TYPE_ERROR) &&
+           sender &&
+           g_dbus_message_get_destination (message))
+    {
+      pending = gb_traffic_find_pending (traffic,
+                                         g_dbus_message_get_destination (message),
+                                         g_dbus_message_get_reply_serial (message),
+                                         FALSE);
+
+      /*
+       * Latency is charged to the peer that answered, under the
+       * interface that was called.
+       */
+      if (pending)
+        {
+          entry = gb_traffic_lookup (traffic, sender, pending->interface);
+          entry->n_replies++;
+          entry->latency += g_get_monotonic_time () - pending->begin;
+          pending->serial = 0;
+        }
+    }
+
+  g_mutex_unlock (&traffic->mutex);
+
+  /*
+   * A monitor must never answer anything, so swallow every message.
+   */
+  g_object_unref (message);
+
+  return NULL;
+}
+
 GbDbusDaemon *
 gb_dbus_daemon_new (void)
 {
@@ -247,6 +479,170 @@ gb_dbus_daemon_start (GbDbusDaemon *daemon)
   g_object_notify_by_pspec (G_OBJECT (daemon), gParamSpecs[PROP_CONNECTION]);
 }
 
+/*
+ * Attaches a second connection to the bus that becomes a monitor and
+ * tallies every message by sender and interface, along with method call
+ * latency matched from call to reply. Sizes count message bodies only.
+ */
+gboolean
+gb_dbus_daemon_start_monitor (GbDbusDaemon  *daemon,
+                              GError       **error)
+{
+  GbDbusDaemonPrivate *priv;
+  GDBusConnection *monitor;
+  const gchar *rules[] = { NULL };
+  GVariant *reply;
+
+  g_return_val_if_fail (GB_IS_DBUS_DAEMON (daemon), FALSE);
+
+  priv = daemon->priv;
+
+  if (!priv->address)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_CONNECTED,
+                   _("dbus-daemon has not been started."));
+      return FALSE;
+    }
+
+  if (priv->monitor)
+    return TRUE;
+
+  monitor =
+    g_dbus_connection_new_for_address_sync (priv->address,
+                                            (G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                             G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+                                            NULL,
+                                            NULL,
+                                            error);
+
+  if (!monitor)
+    return FALSE;
+
+  reply = g_dbus_connection_call_sync (monitor,
+                                       "org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus.Monitoring",
+                                       "BecomeMonitor",
+                                       g_variant_new ("(^asu)", rules, 0),
+                                       NULL,
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1,
+                                       NULL,
+                                       error);
+
+  if (!reply)
+    {
+      g_object_unref (monitor);
+      return FALSE;
+    }
+
+  g_variant_unref (reply);
+
+  if (!priv->traffic)
+    {
+      priv->traffic = g_new0 (GbTraffic, 1);
+      g_mutex_init (&priv->traffic->mutex);
+    }
+
+  g_dbus_connection_add_filter (monitor, monitor_filter, priv->traffic, NULL);
+  priv->monitor = monitor;
+
+  return TRUE;
+}
+
+void
+gb_dbus_daemon_stop_monitor (GbDbusDaemon *daemon)
+{
+  GbDbusDaemonPrivate *priv;
+
+  g_return_if_fail (GB_IS_DBUS_DAEMON (daemon));
+
+  priv = daemon->priv;
+
+  /*
+   * Closing synchronously guarantees the filter is done with the tables
+   * before they can be freed.
+   */
+  if (priv->monitor)
+    {
+      g_dbus_connection_close_sync (priv->monitor, NULL, NULL);
+      g_clear_object (&priv->monitor);
+    }
+}
+
+/*
+ * Returns the counters gathered by the monitor as a floating
+ * a(sstttt) of sender, interface, messages, bytes, replies and the total
+ * reply latency in microseconds, busiest sender first.
+ */
+GVariant *
+gb_dbus_daemon_get_traffic (GbDbusDaemon *daemon)
+{
+  GbDbusDaemonPrivate *priv;
+  GVariantBuilder builder;
+  GbTrafficEntry *entries;
+  GbTrafficEntry *entry;
+  guint n_entries = 0;
+  guint i;
+
+  g_return_val_if_fail (GB_IS_DBUS_DAEMON (daemon), NULL);
+
+  priv = daemon->priv;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sstttt)"));
+
+  if (!priv->traffic)
+    return g_variant_builder_end (&builder);
+
+  entries = g_new0 (GbTrafficEntry, TRAFFIC_SLOTS + 1);
+
+  g_mutex_lock (&priv->traffic->mutex);
+
+  for (i = 0; i < TRAFFIC_SLOTS; i++)
+    {
+      if (priv->traffic->entries[i].sender)
+        entries[n_entries++] = priv->traffic->entries[i];
+    }
+
+  if (priv->traffic->overflow.n_messages || priv->traffic->overflow.n_replies)
+    {
+      entries[n_entries] = priv->traffic->overflow;
+      entries[n_entries].sender = "*";
+      entries[n_entries].interface = "*";
+      n_entries++;
+    }
+
+  for (i = 0; i < n_entries; i++)
+    {
+      entries[i].sender = g_strdup (entries[i].sender);
+      entries[i].interface = g_strdup (entries[i].interface);
+    }
+
+  g_mutex_unlock (&priv->traffic->mutex);
+
+  qsort (entries, n_entries, sizeof *entries, compare_traffic);
+
+  for (i = 0; i < n_entries; i++)
+    {
+      entry = &entries[i];
+      g_variant_builder_add (&builder, "(sstttt)",
+                             entry->sender,
+                             entry->interface,
+                             entry->n_messages,
+                             entry->n_bytes,
+                             entry->n_replies,
+                             entry->latency);
+      g_free (entry->sender);
+      g_free (entry->interface);
+    }
+
+  g_free (entries);
+
+  return g_variant_builder_end (&builder);
+}
+
 void
 gb_dbus_daemon_stop (GbDbusDaemon *daemon)
 {
@@ -256,6 +652,8 @@ gb_dbus_daemon_stop (GbDbusDaemon *daemon)
 
   priv = daemon->priv;
 
+  gb_dbus_daemon_stop_monitor (daemon);
+
   g_clear_object (&priv->connection);
   g_clear_pointer (&priv->address, g_free);
   g_clear_pointer (&priv->config_file, g_free);
@@ -277,6 +675,9 @@ gb_dbus_daemon_finalize (GObject *object)
 
   priv = GB_DBUS_DAEMON (object)->priv;
 
+  gb_dbus_daemon_stop_monitor (GB_DBUS_DAEMON (object));
+  g_clear_pointer (&priv->traffic, gb_traffic_free);
+
   g_clear_object (&priv->connection);
   g_clear_pointer (&priv->address, g_free);
 
@@ -52,8 +52,12 @@ GbDbusDaemon    *gb_dbus_daemon_new            (void);
 GType            gb_dbus_daemon_get_type       (void) G_GNUC_CONST;
 GDBusConnection *gb_dbus_daemon_get_connection (GbDbusDaemon *daemon);
 const gchar     *gb_dbus_daemon_get_address    (GbDbusDaemon *daemon);
+GVariant        *gb_dbus_daemon_get_traffic    (GbDbusDaemon *daemon);
 void             gb_dbus_daemon_start          (GbDbusDaemon *daemon);
+gboolean         gb_dbus_daemon_start_monitor  (GbDbusDaemon *daemon,
+                                                GError      **error);
 void             gb_dbus_daemon_stop           (GbDbusDaemon *daemon);
+void             gb_dbus_daemon_stop_monitor   (GbDbusDaemon *daemon);
 
 G_END_DECLS
 
@@ -0,0 +1,485 @@
+/* gb-job-queue.c
+ *
+ * Copyright (C) 2013 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "gb-job-queue.h"
+
+typedef struct
+{
+  GbJobQueue     *queue;
+  guint           id;
+  gint            priority;
+  gchar         **argv;
+  GSequenceIter  *iter;
+  GSubprocess    *subprocess;
+  GPid            pid;
+  gint64          queued_at;
+  gint64          started_at;
+} GbJob;
+
+struct _GbJobQueuePrivate
+{
+  GbSupervisor *supervisor;
+  GSequence    *pending;
+  GHashTable   *jobs;
+  guint         max_running;
+  guint         n_running;
+  guint         last_id;
+};
+
+enum
+{
+  PROP_0,
+  PROP_MAX_RUNNING,
+  PROP_SUPERVISOR,
+  LAST_PROP
+};
+
+enum
+{
+  JOB_FINISHED,
+  LAST_SIGNAL
+};
+
+G_DEFINE_TYPE_WITH_CODE (GbJobQueue,
+                         gb_job_queue,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GbJobQueue))
+
+static GParamSpec * gParamSpecs[LAST_PROP];
+static guint gSignals[LAST_SIGNAL];
+
+static void gb_job_queue_pump (GbJobQueue *queue);
+
+static void
+gb_job_free (GbJob *job)
+{
+  if (job)
+    {
+      g_strfreev (job->argv);
+      g_clear_object (&job->subprocess);
+      g_slice_free (GbJob, job);
+    }
+}
+
+/*
+ * Higher priorities run first, and jobs of the same priority run in the
+ * order they were submitted.
+ */
+static gint
+compare_jobs (gconstpointer a,
+              gconstpointer b,
+              gpointer      user_data)
+{
+  const GbJob *job_a = a;
+  const GbJob *job_b = b;
+
+  if (job_a->priority != job_b->priority)
+    return (job_a->priority > job_b->priority) ? -1 : 1;
+
+  return (job_a->id < job_b->id) ? -1 : (job_a->id > job_b->id);
+}
+
+static void
+gb_job_queue_finish (GbJobQueue *queue,
+                     GbJob      *job,
+                     gint        status)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 queued_usec;
+  gint64 run_usec;
+
+  if (job->started_at)
+    {
+      queued_usec = job->started_at - job->queued_at;
+      run_usec = now - job->started_at;
+    }
+  else
+    {
+      queued_usec = now - job->queued_at;
+      run_usec = 0;
+    }
+
+  g_signal_emit (queue, gSignals[JOB_FINISHED], 0,
+                 job->id, status, queued_usec, run_usec);
+
+  g_hash_table_remove (queue->priv->jobs, GUINT_TO_POINTER (job->id));
+}
+
+static void
+wait_cb (GObject      *object,
+         GAsyncResult *result,
+         gpointer      user_data)
+{
+  GSubprocess *subprocess = (GSubprocess *)object;
+  GbJob *job = user_data;
+  GbJobQueue *queue = job->queue;
+  GError *error = NULL;
+
+  if (!g_subprocess_wait_finish (subprocess, result, &error))
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+    }
+
+  /*
+   * The pid is free for reuse now, so the supervisor must forget it.
+   */
+  gb_supervisor_remove_pid (queue->priv->supervisor, job->pid);
+
+  queue->priv->n_running--;
+
+  gb_job_queue_finish (queue, job, g_subprocess_get_status (subprocess));
+  gb_job_queue_pump (queue);
+
+  g_object_unref (queue);
+}
+
+static gboolean
+gb_job_queue_spawn (GbJobQueue *queue,
+                    GbJob      *job)
+{
+  GbJobQueuePrivate *priv = queue->priv;
+  GError *error = NULL;
+
+  job->started_at = g_get_monotonic_time ();
+  job->subprocess = g_subprocess_newv ((const gchar * const *)job->argv,
+                                       G_SUBPROCESS_FLAGS_NONE,
+                                       &error);
+
+  if (!job->subprocess)
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  job->pid = atoi (g_subprocess_get_identifier (job->subprocess));
+  gb_supervisor_add_subprocess (priv->supervisor, job->subprocess);
+
+  priv->n_running++;
+
+  g_subprocess_wait_async (job->subprocess,
+                           NULL,
+                           wait_cb,
+                           job);
+
+  g_object_ref (queue);
+
+  return TRUE;
+}
+
+static gboolean
+spawn_failed_cb (gpointer user_data)
+{
+  GbJob *job = user_data;
+  GbJobQueue *queue = job->queue;
+
+  gb_job_queue_finish (queue, job, -1);
+  g_object_unref (queue);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Starts pending jobs until the concurrency limit is reached. Jobs that
+ * fail to spawn are reported from the main loop, so a caller of
+ * gb_job_queue_submit() always knows the id before it hears about it.
+ */
+static void
+gb_job_queue_pump (GbJobQueue *queue)
+{
+  GbJobQueuePrivate *priv = queue->priv;
+  GSequenceIter *iter;
+  GbJob *job;
+
+  while (priv->n_running < priv->max_running &&
+         g_sequence_get_length (priv->pending))
+    {
+      iter = g_sequence_get_begin_iter (priv->pending);
+      job = g_sequence_get (iter);
+      g_sequence_remove (iter);
+      job->iter = NULL;
+
+      if (!gb_job_queue_spawn (queue, job))
+        {
+          g_idle_add (spawn_failed_cb, job);
+          g_object_ref (queue);
+        }
+    }
+}
+
+/*
+ * Queues @argv to run once fewer than the maximum number of jobs are
+ * running. Returns an identifier for the job that is passed to
+ * GbJobQueue::job-finished and gb_job_queue_cancel().
+ */
+guint
+gb_job_queue_submit (GbJobQueue          *queue,
+                     const gchar * const *argv,
+                     gint                 priority)
+{
+  GbJobQueuePrivate *priv;
+  GbJob *job;
+
+  g_return_val_if_fail (GB_IS_JOB_QUEUE (queue), 0);
+  g_return_val_if_fail (argv && argv[0], 0);
+
+  priv = queue->priv;
+
+  job = g_slice_new0 (GbJob);
+  job->queue = queue;
+  job->id = ++priv->last_id;
+  job->priority = priority;
+  job->argv = g_strdupv ((gchar **)argv);
+  job->queued_at = g_get_monotonic_time ();
+  job->iter = g_sequence_insert_sorted (priv->pending, job, compare_jobs, NULL);
+
+  g_hash_table_insert (priv->jobs, GUINT_TO_POINTER (job->id), job);
+
+  gb_job_queue_pump (queue);
+
+  return job->id;
+}
+
+/*
+ * Pending jobs are dropped and reported as finished right away with a
+ * status of -1. Running jobs are sent SIGTERM and reported once they
+ * exit. Jobs that failed to spawn are reported shortly anyway.
+ */
+gboolean
+gb_job_queue_cancel (GbJobQueue *queue,
+                     guint       job_id)
+{
+  GbJob *job;
+
+  g_return_val_if_fail (GB_IS_JOB_QUEUE (queue), FALSE);
+
+  if (!(job = g_hash_table_lookup (queue->priv->jobs, GUINT_TO_POINTER (job_id))))
+    return FALSE;
+
+  if (job->iter)
+    {
+      g_sequence_remove (job->iter);
+      job->iter = NULL;
+      gb_job_queue_finish (queue, job, -1);
+    }
+  else if (job->subprocess)
+    {
+      g_subprocess_send_signal (job->subprocess, SIGTERM);
+    }
+
+  return TRUE;
+}
+
+void
+gb_job_queue_cancel_all (GbJobQueue *queue)
+{
+  GList *ids;
+  GList *l;
+
+  g_return_if_fail (GB_IS_JOB_QUEUE (queue));
+
+  /*
+   * Cancelling pending jobs emits signals whose handlers may submit more
+   * work, so walk a snapshot of the identifiers.
+   */
+  ids = g_hash_table_get_keys (queue->priv->jobs);
+
+  for (l = ids; l; l = l->next)
+    gb_job_queue_cancel (queue, GPOINTER_TO_UINT (l->data));
+
+  g_list_free (ids);
+}
+
+guint
+gb_job_queue_get_max_running (GbJobQueue *queue)
+{
+  g_return_val_if_fail (GB_IS_JOB_QUEUE (queue), 0);
+
+  return queue->priv->max_running;
+}
+
+/*
+ * Sets how many jobs may run at the same time. Zero means one per
+ * processor.
+ */
+void
+gb_job_queue_set_max_running (GbJobQueue *queue,
+                              guint       max_running)
+{
+  g_return_if_fail (GB_IS_JOB_QUEUE (queue));
+
+  if (!max_running)
+    max_running = g_get_num_processors ();
+
+  if (queue->priv->max_running != max_running)
+    {
+      queue->priv->max_running = max_running;
+      gb_job_queue_pump (queue);
+      g_object_notify_by_pspec (G_OBJECT (queue),
+                                gParamSpecs[PROP_MAX_RUNNING]);
+    }
+}
+
+guint
+gb_job_queue_get_n_pending (GbJobQueue *queue)
+{
+  g_return_val_if_fail (GB_IS_JOB_QUEUE (queue), 0);
+
+  return g_sequence_get_length (queue->priv->pending);
+}
+
+guint
+gb_job_queue_get_n_running (GbJobQueue *queue)
+{
+  g_return_val_if_fail (GB_IS_JOB_QUEUE (queue), 0);
+
+  return queue->priv->n_running;
+}
+
+GbJobQueue *
+gb_job_queue_new (GbSupervisor *supervisor)
+{
+  g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), NULL);
+
+  return g_object_new (GB_TYPE_JOB_QUEUE,
+                       "supervisor", supervisor,
+                       NULL);
+}
+
+static void
+gb_job_queue_finalize (GObject *object)
+{
+  GbJobQueuePrivate *priv = GB_JOB_QUEUE (object)->priv;
+
+  g_clear_pointer (&priv->pending, (GDestroyNotify)g_sequence_free);
+  g_clear_pointer (&priv->jobs, (GDestroyNotify)g_hash_table_unref);
+  g_clear_object (&priv->supervisor);
+
+  G_OBJECT_CLASS (gb_job_queue_parent_class)->finalize (object);
+}
+
+static void
+gb_job_queue_get_property (GObject    *object,
+                           guint       prop_id,
+                           GValue     *value,
+                           GParamSpec *pspec)
+{
+  GbJobQueue *queue = GB_JOB_QUEUE (object);
+
+  switch (prop_id) {
+  case PROP_MAX_RUNNING:
+    g_value_set_uint (value, queue->priv->max_running);
+    break;
+  case PROP_SUPERVISOR:
+    g_value_set_object (value, queue->priv->supervisor);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+static void
+gb_job_queue_set_property (GObject      *object,
+                           guint         prop_id,
+                           const GValue *value,
+                           GParamSpec   *pspec)
+{
+  GbJobQueue *queue = GB_JOB_QUEUE (object);
+
+  switch (prop_id) {
+  case PROP_MAX_RUNNING:
+    gb_job_queue_set_max_running (queue, g_value_get_uint (value));
+    break;
+  case PROP_SUPERVISOR:
+    queue->priv->supervisor = g_value_dup_object (value);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+static void
+gb_job_queue_class_init (GbJobQueueClass *klass)
+{
+  GObjectClass *object_class;
+
+  object_class = G_OBJECT_CLASS (klass);
+  object_class->finalize = gb_job_queue_finalize;
+  object_class->get_property = gb_job_queue_get_property;
+  object_class->set_property = gb_job_queue_set_property;
+
+  gParamSpecs[PROP_MAX_RUNNING] =
+    g_param_spec_uint ("max-running",
+                       _ ("Max Running"),
+                       _ ("The maximum number of jobs running at once."),
+                       0,
+                       G_MAXUINT,
+                       0,
+                       (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class, PROP_MAX_RUNNING,
+                                   gParamSpecs[PROP_MAX_RUNNING]);
+
+  gParamSpecs[PROP_SUPERVISOR] =
+    g_param_spec_object ("supervisor",
+                         _ ("Supervisor"),
+                         _ ("The supervisor every job is registered with."),
+                         GB_TYPE_SUPERVISOR,
+                         (G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class, PROP_SUPERVISOR,
+                                   gParamSpecs[PROP_SUPERVISOR]);
+
+  /*
+   * @status is the wait status of the job, or -1 if it was cancelled
+   * before it started or could not be spawned. The timings are in
+   * microseconds.
+   */
+  gSignals[JOB_FINISHED] =
+    g_signal_new ("job-finished",
+                  GB_TYPE_JOB_QUEUE,
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL,
+                  NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  4,
+                  G_TYPE_UINT,
+                  G_TYPE_INT,
+                  G_TYPE_INT64,
+                  G_TYPE_INT64);
+}
+
+static void
+gb_job_queue_init (GbJobQueue *queue)
+{
+  queue->priv = gb_job_queue_get_instance_private (queue);
+
+  queue->priv->max_running = g_get_num_processors ();
+  queue->priv->pending = g_sequence_new (NULL);
+  queue->priv->jobs = g_hash_table_new_full (g_direct_hash,
+                                             g_direct_equal,
+                                             NULL,
+                                             (GDestroyNotify)gb_job_free);
+}
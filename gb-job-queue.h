@@ -0,0 +1,69 @@
+/* gb-job-queue.h
+ *
+ * Copyright (C) 2013 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GB_JOB_QUEUE_H
+#define GB_JOB_QUEUE_H
+
+#include <gio/gio.h>
+
+#include "gb-supervisor.h"
+
+G_BEGIN_DECLS
+
+#define GB_TYPE_JOB_QUEUE            (gb_job_queue_get_type())
+#define GB_JOB_QUEUE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GB_TYPE_JOB_QUEUE, GbJobQueue))
+#define GB_JOB_QUEUE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GB_TYPE_JOB_QUEUE, GbJobQueue const))
+#define GB_JOB_QUEUE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GB_TYPE_JOB_QUEUE, GbJobQueueClass))
+#define GB_IS_JOB_QUEUE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GB_TYPE_JOB_QUEUE))
+#define GB_IS_JOB_QUEUE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GB_TYPE_JOB_QUEUE))
+#define GB_JOB_QUEUE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GB_TYPE_JOB_QUEUE, GbJobQueueClass))
+
+typedef struct _GbJobQueue        GbJobQueue;
+typedef struct _GbJobQueueClass   GbJobQueueClass;
+typedef struct _GbJobQueuePrivate GbJobQueuePrivate;
+
+struct _GbJobQueue
+{
+   GObject parent;
+
+   /*< private >*/
+   GbJobQueuePrivate *priv;
+};
+
+struct _GbJobQueueClass
+{
+   GObjectClass parent_class;
+};
+
+gboolean    gb_job_queue_cancel           (GbJobQueue          *queue,
+                                           guint                job_id);
+void        gb_job_queue_cancel_all       (GbJobQueue          *queue);
+guint       gb_job_queue_get_max_running  (GbJobQueue          *queue);
+guint       gb_job_queue_get_n_pending    (GbJobQueue          *queue);
+guint       gb_job_queue_get_n_running    (GbJobQueue          *queue);
+GType       gb_job_queue_get_type         (void) G_GNUC_CONST;
+GbJobQueue *gb_job_queue_new              (GbSupervisor        *supervisor);
+void        gb_job_queue_set_max_running  (GbJobQueue          *queue,
+                                           guint                max_running);
+guint       gb_job_queue_submit           (GbJobQueue          *queue,
+                                           const gchar * const *argv,
+                                           gint                 priority);
+
+G_END_DECLS
+
+#endif /* GB_JOB_QUEUE_H */
@@ -0,0 +1,318 @@
+/* gb-log-file.c
+ *
+ * Copyright (C) 2013 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <unistd.h>
+
+#include "gb-log-file.h"
+
+#define CHUNK_SIZE (64 * 1024)
+
+typedef struct
+{
+  GbLogFile *log;
+  GPid       pid;
+  gint       fd;
+  guint      handler;
+} GbLogPipe;
+
+struct _GbLogFile
+{
+  gchar     *path;
+  GPtrArray *pipes;
+  guint64    max_size;
+  loff_t     offset;
+  GPid       last_pid;
+  guint      n_files;
+  gint       fd;
+  gint       bounce[2];
+  guint      closing : 1;
+};
+
+static void
+gb_log_pipe_free (GbLogPipe *pipe)
+{
+  if (pipe->handler)
+    g_source_remove (pipe->handler);
+
+  close (pipe->fd);
+  g_slice_free (GbLogPipe, pipe);
+}
+
+static gboolean
+gb_log_file_open (GbLogFile  *log,
+                  GError    **error)
+{
+  /*
+   * splice() refuses O_APPEND files, so the write offset is tracked
+   * here instead. Every writer lives on this main loop.
+   */
+  log->fd = open (log->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0640);
+
+  if (log->fd == -1)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   g_file_error_from_errno (errno),
+                   "%s: %s", log->path, g_strerror (errno));
+      return FALSE;
+    }
+
+  log->offset = lseek (log->fd, 0, SEEK_END);
+  log->last_pid = 0;
+
+  return TRUE;
+}
+
+/*
+ * Shifts path.N-1 to path.N and so on down to path itself, then starts a
+ * fresh file.
+ */
+static void
+gb_log_file_rotate (GbLogFile *log)
+{
+  gchar *from;
+  gchar *to;
+  guint i;
+
+  close (log->fd);
+  log->fd = -1;
+
+  for (i = log->n_files; i > 0; i--)
+    {
+      from = (i > 1) ? g_strdup_printf ("%s.%u", log->path, i - 1)
+                     : g_strdup (log->path);
+      to = g_strdup_printf ("%s.%u", log->path, i);
+      g_rename (from, to);
+      g_free (from);
+      g_free (to);
+    }
+
+  if (!log->n_files)
+    g_unlink (log->path);
+
+  if (!gb_log_file_open (log, NULL))
+    g_warning ("Failed to reopen %s after rotation.", log->path);
+}
+
+static void
+gb_log_file_write_tag (GbLogFile *log,
+                       GPid       pid)
+{
+  gchar tag[48];
+  gssize len;
+
+  len = g_snprintf (tag, sizeof tag, "\n[pid %u]\n", (guint)pid);
+
+  if (pwrite (log->fd, tag, len, log->offset) == len)
+    log->offset += len;
+
+  log->last_pid = pid;
+}
+
+/*
+ * Writes @len bytes sitting in the bounce pipe to the log file. Falls
+ * back to a buffer on file systems that cannot splice. Whatever the file
+ * refuses is dropped so it cannot be attributed to the next writer.
+ */
+static void
+gb_log_file_flush (GbLogFile *log,
+                   gsize      len)
+{
+  gchar buf[4096];
+  gssize n;
+
+  while (len)
+    {
+      n = splice (log->bounce[0], NULL, log->fd, &log->offset, len,
+                  SPLICE_F_MOVE);
+
+      if (n == -1 && errno == EINVAL &&
+          (n = read (log->bounce[0], buf, MIN (len, sizeof buf))) > 0)
+        {
+          if (pwrite (log->fd, buf, n, log->offset) == n)
+            log->offset += n;
+        }
+
+      if (n <= 0)
+        break;
+
+      len -= n;
+    }
+
+  while (len && (n = read (log->bounce[0], buf, MIN (len, sizeof buf))) > 0)
+    len -= n;
+}
+
+/*
+ * Moves whatever is buffered in the pipe of @pipe straight into the page
+ * cache of the log file. The data goes through a pipe of our own first,
+ * so the pid tag is only written once we know there is something to
+ * attribute.
+ */
+static gssize
+gb_log_file_move (GbLogFile *log,
+                  GbLogPipe *pipe)
+{
+  gssize len;
+
+  len = splice (pipe->fd, NULL, log->bounce[1], NULL, CHUNK_SIZE,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+  if (len <= 0)
+    return len;
+
+  if (log->last_pid != pipe->pid)
+    gb_log_file_write_tag (log, pipe->pid);
+
+  gb_log_file_flush (log, len);
+
+  return len;
+}
+
+static gboolean
+pipe_cb (gint         fd,
+         GIOCondition condition,
+         gpointer     user_data)
+{
+  GbLogPipe *pipe = user_data;
+  GbLogFile *log = pipe->log;
+  gssize len;
+
+  if (log->fd == -1)
+    goto finish;
+
+  if (log->max_size && log->offset >= log->max_size)
+    gb_log_file_rotate (log);
+
+  if (log->fd == -1)
+    goto finish;
+
+  len = gb_log_file_move (log, pipe);
+
+  if (len > 0 || (len == -1 && errno == EAGAIN))
+    return G_SOURCE_CONTINUE;
+
+finish:
+  pipe->handler = 0;
+  g_ptr_array_remove_fast (log->pipes, pipe);
+
+  if (log->closing && !log->pipes->len)
+    gb_log_file_free (log);
+
+  return G_SOURCE_REMOVE;
+}
+
+GbLogFile *
+gb_log_file_new (const gchar  *path,
+                 guint64       max_size,
+                 guint         n_files,
+                 GError      **error)
+{
+  GbLogFile *log;
+
+  g_return_val_if_fail (path, NULL);
+
+  log = g_slice_new0 (GbLogFile);
+  log->path = g_strdup (path);
+  log->max_size = max_size;
+  log->n_files = n_files;
+  log->pipes = g_ptr_array_new_with_free_func ((GDestroyNotify)gb_log_pipe_free);
+  log->fd = -1;
+  log->bounce[0] = -1;
+  log->bounce[1] = -1;
+
+  if (!g_unix_open_pipe (log->bounce, FD_CLOEXEC, error) ||
+      !g_unix_set_fd_nonblocking (log->bounce[0], TRUE, error) ||
+      !gb_log_file_open (log, error))
+    {
+      gb_log_file_free (log);
+      return NULL;
+    }
+
+  return log;
+}
+
+void
+gb_log_file_free (GbLogFile *log)
+{
+  if (log)
+    {
+      g_ptr_array_unref (log->pipes);
+
+      if (log->fd != -1)
+        close (log->fd);
+
+      if (log->bounce[0] != -1)
+        close (log->bounce[0]);
+
+      if (log->bounce[1] != -1)
+        close (log->bounce[1]);
+
+      g_free (log->path);
+      g_slice_free (GbLogFile, log);
+    }
+}
+
+/*
+ * Stops using @log for new processes. Pipes of processes that are still
+ * running keep draining into the file until their writers close them,
+ * and @log is freed after the last one.
+ */
+void
+gb_log_file_close (GbLogFile *log)
+{
+  if (log)
+    {
+      if (!log->pipes->len)
+        gb_log_file_free (log);
+      else
+        log->closing = TRUE;
+    }
+}
+
+/*
+ * Takes ownership of @fd, the read end of a pipe connected to the
+ * stdout and stderr of @pid, and copies everything written to it into
+ * the log until the last writer closes it.
+ */
+void
+gb_log_file_attach (GbLogFile *log,
+                    GPid       pid,
+                    gint       fd)
+{
+  GbLogPipe *pipe;
+
+  g_return_if_fail (log);
+  g_return_if_fail (fd != -1);
+
+  g_unix_set_fd_nonblocking (fd, TRUE, NULL);
+
+  pipe = g_slice_new0 (GbLogPipe);
+  pipe->log = log;
+  pipe->pid = pid;
+  pipe->fd = fd;
+  pipe->handler = g_unix_fd_add (fd, G_IO_IN | G_IO_HUP, pipe_cb, pipe);
+
+  g_ptr_array_add (log->pipes, pipe);
+}
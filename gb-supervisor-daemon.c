@@ -0,0 +1,443 @@
+/* gb-supervisor-daemon.c
+ *
+ * Copyright (C) 2013 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gi18n.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __linux
+#include <sys/prctl.h>
+#endif
+
+#include "gb-supervisor-daemon.h"
+
+/*
+ * The shared supervisor lingers this long after its last client went
+ * away, so short-lived programs run back to back reuse it.
+ */
+#define IDLE_TIMEOUT_MSEC   10000
+#define ACCEPT_TIMEOUT_MSEC 1000
+#define CONNECT_ATTEMPTS    100
+
+typedef struct
+{
+  gint          fd;
+  struct ucred  cred;
+  GString      *buffer;
+  GHashTable   *pids;
+} GbDaemonClient;
+
+static gchar *
+get_socket_path (void)
+{
+  return g_build_filename (g_get_user_runtime_dir (),
+                           "gb-supervisor.socket",
+                           NULL);
+}
+
+static gboolean
+fill_address (struct sockaddr_un *addr,
+              const gchar        *path)
+{
+  memset (addr, 0, sizeof *addr);
+  addr->sun_family = AF_UNIX;
+
+  if (strlen (path) >= sizeof addr->sun_path)
+    return FALSE;
+
+  strcpy (addr->sun_path, path);
+
+  return TRUE;
+}
+
+static void
+gb_daemon_client_free (GbDaemonClient *client)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  /*
+   * The connection is gone, so its owner is too. Reap only the
+   * processes this client registered. Stopped children need SIGCONT to
+   * act on SIGTERM, and those frozen through their cgroup only react to
+   * SIGKILL.
+   */
+  g_hash_table_iter_init (&iter, client->pids);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      g_printerr ("Reaping %u for %u\n",
+                  GPOINTER_TO_UINT (key),
+                  (guint)client->cred.pid);
+      kill (GPOINTER_TO_INT (key), SIGTERM);
+      kill (GPOINTER_TO_INT (key), SIGCONT);
+
+      if (value)
+        kill (GPOINTER_TO_INT (key), SIGKILL);
+    }
+
+  close (client->fd);
+  g_hash_table_unref (client->pids);
+  g_string_free (client->buffer, TRUE);
+  g_slice_free (GbDaemonClient, client);
+}
+
+static gboolean
+gb_daemon_client_read (GbDaemonClient *client)
+{
+  gchar buf[4096];
+  gchar *line;
+  gchar *nl;
+  gssize len;
+  gchar mode;
+  guint pid;
+
+  len = read (client->fd, buf, sizeof buf);
+
+  if (len <= 0)
+    return (len == -1 && errno == EINTR);
+
+  g_string_append_len (client->buffer, buf, len);
+
+  while ((nl = memchr (client->buffer->str, '\n', client->buffer->len)))
+    {
+      *nl = '\0';
+      line = client->buffer->str;
+
+      if (2 != sscanf (line, "%c %u", &mode, &pid))
+        return FALSE;
+
+      switch (mode) {
+        case 'a':
+          g_hash_table_insert (client->pids, GUINT_TO_POINTER (pid), NULL);
+          break;
+        case 'r':
+          g_hash_table_remove (client->pids, GUINT_TO_POINTER (pid));
+          break;
+        case 'f':
+        case 't':
+          if (g_hash_table_contains (client->pids, GUINT_TO_POINTER (pid)))
+            g_hash_table_insert (client->pids, GUINT_TO_POINTER (pid),
+                                 GINT_TO_POINTER (mode == 'f'));
+          break;
+        default:
+          return FALSE;
+      }
+
+      g_string_erase (client->buffer, 0, nl - line + 1);
+    }
+
+  return TRUE;
+}
+
+static void
+gb_daemon_accept (gint       listen_fd,
+                  GPtrArray *clients)
+{
+  GbDaemonClient *client;
+  struct ucred cred;
+  socklen_t len = sizeof cred;
+  gint fd;
+
+  while (-1 != (fd = accept4 (listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)))
+    {
+      /*
+       * Only the user owning the runtime directory may hand us pids to
+       * kill on its behalf.
+       */
+      if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+          cred.uid != getuid ())
+        {
+          close (fd);
+          continue;
+        }
+
+      /*
+       * Tell the client it was picked up. A connection still sitting in
+       * the backlog when we stop listening is reset instead, and the
+       * client starts a new daemon.
+       */
+      if (send (fd, "", 1, MSG_NOSIGNAL) != 1)
+        {
+          close (fd);
+          continue;
+        }
+
+      client = g_slice_new0 (GbDaemonClient);
+      client->fd = fd;
+      client->cred = cred;
+      client->buffer = g_string_new (NULL);
+      client->pids = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+      g_ptr_array_add (clients, client);
+    }
+}
+
+static void
+gb_daemon_serve (const gchar *path)
+{
+  struct sockaddr_un addr;
+  struct pollfd *fds;
+  GbDaemonClient *client;
+  GPtrArray *clients;
+  gchar *lock_path;
+  gint listen_fd;
+  gint lock_fd;
+  gint timeout;
+  guint n_fds;
+  guint i;
+
+  /*
+   * Only one daemon may own the socket. Whoever loses the race exits and
+   * its client simply connects to the winner.
+   */
+  lock_path = g_strdup_printf ("%s.lock", path);
+  lock_fd = open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  g_free (lock_path);
+
+  if (lock_fd == -1 || flock (lock_fd, LOCK_EX | LOCK_NB) != 0)
+    _exit (EXIT_SUCCESS);
+
+  if (!fill_address (&addr, path))
+    _exit (EXIT_FAILURE);
+
+  unlink (path);
+  umask (0077);
+
+  listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+  if (listen_fd == -1 ||
+      bind (listen_fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+      listen (listen_fd, 128) != 0)
+    _exit (EXIT_FAILURE);
+
+  clients = g_ptr_array_new_with_free_func ((GDestroyNotify)gb_daemon_client_free);
+  fds = g_new0 (struct pollfd, 1);
+
+  for (;;)
+    {
+      fds = g_renew (struct pollfd, fds, clients->len + 1);
+      n_fds = 0;
+
+      if (listen_fd != -1)
+        {
+          fds[n_fds].fd = listen_fd;
+          fds[n_fds].events = POLLIN;
+          n_fds++;
+        }
+
+      for (i = 0; i < clients->len; i++)
+        {
+          client = g_ptr_array_index (clients, i);
+          fds[n_fds].fd = client->fd;
+          fds[n_fds].events = POLLIN;
+          n_fds++;
+        }
+
+      timeout = clients->len ? -1 : IDLE_TIMEOUT_MSEC;
+
+      if (poll (fds, n_fds, timeout) == 0)
+        {
+          /*
+           * Idle. Stop being discoverable first, then pick up anyone who
+           * connected in the meantime before deciding to exit.
+           */
+          unlink (path);
+          close (lock_fd);
+          gb_daemon_accept (listen_fd, clients);
+          close (listen_fd);
+          listen_fd = -1;
+        }
+      else
+        {
+          for (i = n_fds; i > 0; i--)
+            {
+              if (!fds[i - 1].revents)
+                continue;
+
+              if (fds[i - 1].fd == listen_fd)
+                {
+                  gb_daemon_accept (listen_fd, clients);
+                  continue;
+                }
+
+              client = g_ptr_array_index (clients, i - 1 - (listen_fd != -1));
+
+              if (!gb_daemon_client_read (client))
+                g_ptr_array_remove_index_fast (clients, i - 1 - (listen_fd != -1));
+            }
+        }
+
+      if (listen_fd == -1 && !clients->len)
+        _exit (EXIT_SUCCESS);
+    }
+}
+
+static void
+gb_daemon_spawn (const gchar *path)
+{
+  GPid pid;
+  gint max_fd;
+  gint fd;
+
+  if (-1 == (pid = fork ()))
+    return;
+
+  if (pid)
+    {
+      waitpid (pid, NULL, 0);
+      return;
+    }
+
+  /*
+   * Detach twice so the daemon belongs to no client's session and is
+   * reparented away from whichever process happened to start it.
+   */
+  setsid ();
+
+  if (fork () != 0)
+    _exit (EXIT_SUCCESS);
+
+  max_fd = MIN (sysconf (_SC_OPEN_MAX), 65536);
+
+  for (fd = 3; fd < max_fd; fd++)
+    close (fd);
+
+  if (-1 != (fd = open ("/dev/null", O_RDWR)))
+    {
+      dup2 (fd, STDIN_FILENO);
+      dup2 (fd, STDOUT_FILENO);
+      dup2 (fd, STDERR_FILENO);
+      close (fd);
+    }
+
+  signal (SIGPIPE, SIG_IGN);
+
+#ifdef __linux
+  prctl (PR_SET_NAME, "gb-supervisor");
+#endif
+
+  gb_daemon_serve (path);
+}
+
+/*
+ * Waits for the byte a daemon sends once it accepted @fd. Returns FALSE
+ * if the daemon went away with our connection still in its backlog.
+ */
+static gboolean
+gb_daemon_wait_accepted (gint fd)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  gchar c;
+
+  if (poll (&pfd, 1, ACCEPT_TIMEOUT_MSEC) != 1)
+    {
+      errno = ETIMEDOUT;
+      return FALSE;
+    }
+
+  if (recv (fd, &c, 1, 0) != 1)
+    {
+      errno = ECONNRESET;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Returns a connection to the per-user supervisor, starting it if
+ * nobody has yet. Each connection carries its own set of pids, which
+ * are sent SIGTERM when the connection closes.
+ */
+gint
+gb_supervisor_daemon_connect (GError **error)
+{
+  struct sockaddr_un addr;
+  gboolean spawn = TRUE;
+  gchar *path;
+  guint i;
+  gint fd;
+
+  path = get_socket_path ();
+
+  if (!fill_address (&addr, path))
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   G_FILE_ERROR_NAMETOOLONG,
+                   _("Supervisor socket path is too long."));
+      g_free (path);
+      return -1;
+    }
+
+  for (i = 0; i < CONNECT_ATTEMPTS; i++)
+    {
+      fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+      if (fd == -1)
+        break;
+
+      if (connect (fd, (struct sockaddr *)&addr, sizeof addr) == 0 &&
+          gb_daemon_wait_accepted (fd))
+        {
+          g_free (path);
+          return fd;
+        }
+
+      close (fd);
+      fd = -1;
+
+      /*
+       * A reset means we raced an idle daemon on its way out, so a new
+       * one is needed just as on the first attempt.
+       */
+      if (errno == ECONNRESET)
+        spawn = TRUE;
+      else if (errno != ENOENT && errno != ECONNREFUSED)
+        break;
+
+      if (spawn)
+        gb_daemon_spawn (path);
+      else
+        g_usleep (G_USEC_PER_SEC / 100);
+
+      spawn = FALSE;
+    }
+
+  g_set_error (error,
+               G_FILE_ERROR,
+               g_file_error_from_errno (errno),
+               "%s: %s", path, g_strerror (errno));
+  g_free (path);
+
+  return -1;
+}
@@ -16,23 +16,157 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
 #include <glib/gi18n.h>
+#include <glib-unix.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sched.h>
 #include <signal.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include "gb-cgroup.h"
+#include "gb-cpu-topology.h"
+#include "gb-log-file.h"
 #include "gb-supervisor.h"
+#include "gb-supervisor-daemon.h"
+
+#define N_LIMITS     (GB_SUPERVISOR_LIMIT_CPU_MAX + 1)
+#define N_PLACEMENTS (GB_SUPERVISOR_PLACEMENT_CPUSET + 1)
+
+/*
+ * Commands for many pids are written this many bytes at a time. A shard
+ * reads its channel in chunks of 1024 bytes, and a reattached channel is
+ * a SEQPACKET socket that drops whatever a read leaves of a message.
+ */
+#define COMMAND_BATCH 512
+
+/*
+ * A launcher only shrinks once its remaining instances would carry at
+ * most this fraction of the target load, which keeps it from flapping
+ * around a threshold.
+ */
+#define SCALE_DOWN_HEADROOM 0.75
+
+/*
+ * Live children are handed to a reattaching parent this many at a time,
+ * well below the SCM_RIGHTS limit of the kernel.
+ */
+#define HANDOVER_BATCH 64
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+typedef struct
+{
+  GbSupervisor           *supervisor;
+  GSubprocessLauncher    *launcher;
+  gchar                 **argv;
+  GbSupervisorPlacement   placement;
+  GArray                 *cpuset;
+  guint64                 limits[N_LIMITS];
+  GbSupervisorPriority    priority;
+  GPtrArray              *sockets;
+  GArray                 *watches;
+  GPtrArray              *instances;
+  guint                   n_instances;
+  guint                   min_instances;
+  guint                   max_instances;
+  gdouble                 target_load;
+  gdouble                 load_avg;
+  guint                   cooldown;
+  gint64                  last_scale;
+  guint                   scale_handler;
+  GPtrArray              *standby;
+  guint                   n_standby;
+  guint                   standby_handler;
+  GbLogFile              *log;
+  GSpawnChildSetupFunc    child_setup;
+  gpointer                child_setup_data;
+  GDestroyNotify          child_setup_destroy;
+  GSubprocess            *active;
+  guint                   rearm_handler;
+  guint                   tag;
+  guint                   n_adopted;
+  guint                   on_demand : 1;
+  guint                   notify_ready : 1;
+  guint                   child_setup_installed : 1;
+} GbLauncherInfo;
+
+typedef struct
+{
+  GbLauncherInfo *info;
+  GQueue          old;
+  GPtrArray      *starting;
+  GPtrArray      *retiring;
+  guint           batch_size;
+  guint           batch_left;
+  guint           max_surge;
+  GSource        *cancel_source;
+} GbRestart;
 
 struct _GbSupervisorPrivate
 {
-  GHashTable *launchers;
-  GIOChannel *channel;
-  GArray     *pids;
-  GPid        pid;
-  guint       running : 1;
+  GHashTable                 *launchers;
+  GHashTable                 *children;
+  GPtrArray                  *restarts;
+  GPtrArray                  *channels;
+  GArray                     *pids;
+  GbCpuTopology              *topology;
+  gchar                      *cgroup_root;
+  guint                       cgroup_serial;
+  gint                        procs_fd;
+  cpu_set_t                   spawn_cpus;
+  guint                       placement_slots[N_PLACEMENTS];
+  GQueue                      shed;
+  gchar                      *pressure_path;
+  GbSupervisorPressureAction  pressure_action;
+  gdouble                     pressure_restore;
+  gint                        pressure_fd;
+  guint                       pressure_handler;
+  guint                       restore_handler;
+  gchar                      *notify_path;
+  gint                        notify_fd;
+  guint                       notify_handler;
+  GArray                     *shards;
+  guint                       n_shards;
+  guint                       running : 1;
+  guint                       cgroup_failed : 1;
+  gchar                      *grace_name;
+  guint                       grace_period;
+  GHashTable                 *reattached;
+  guint                       shared : 1;
+  guint                       reattached_channels : 1;
+  guint                       spawn_pinned : 1;
+};
+
+typedef struct
+{
+  GbSupervisor   *supervisor;
+  GbLauncherInfo *info;
+  GPid            pid;
+  gint            pidfd;
+  guint           handler;
+  guint           tag;
+} GbReattached;
+
+enum
+{
+  OOM_KILLED,
+  REATTACHED,
+  LAST_SIGNAL
 };
 
 G_DEFINE_TYPE_WITH_CODE (GbSupervisor,
@@ -40,25 +174,293 @@ G_DEFINE_TYPE_WITH_CODE (GbSupervisor,
                          G_TYPE_OBJECT,
                          G_ADD_PRIVATE (GbSupervisor))
 
+static guint gSignals[LAST_SIGNAL];
+
+static GbLauncherInfo *
+gb_launcher_info_new (void)
+{
+  GbLauncherInfo *info;
+
+  info = g_slice_new0 (GbLauncherInfo);
+  info->sockets = g_ptr_array_new_with_free_func (g_object_unref);
+  info->watches = g_array_new (FALSE, FALSE, sizeof (guint));
+  info->instances = g_ptr_array_new ();
+  info->standby = g_ptr_array_new ();
+  info->n_instances = 1;
+
+  return info;
+}
+
 static void
-gb_supervisor_send_command (GbSupervisor *supervisor,
-                            const gchar  *command)
+gb_launcher_info_disarm (GbLauncherInfo *info)
+{
+  guint i;
+
+  for (i = 0; i < info->watches->len; i++)
+    g_source_remove (g_array_index (info->watches, guint, i));
+
+  g_array_set_size (info->watches, 0);
+}
+
+static void
+gb_launcher_info_free (GbLauncherInfo *info)
+{
+  if (info)
+    {
+      gb_launcher_info_disarm (info);
+
+      if (info->rearm_handler)
+        g_source_remove (info->rearm_handler);
+
+      if (info->scale_handler)
+        g_source_remove (info->scale_handler);
+
+      if (info->standby_handler)
+        g_source_remove (info->standby_handler);
+
+      /*
+       * The launcher may outlive us, so give it back the child setup of
+       * the caller in place of ours.
+       */
+      if (info->child_setup_installed)
+        g_subprocess_launcher_set_child_setup (info->launcher,
+                                               info->child_setup,
+                                               info->child_setup_data,
+                                               info->child_setup_destroy);
+      else if (info->child_setup_destroy)
+        info->child_setup_destroy (info->child_setup_data);
+
+      g_object_unref (info->launcher);
+      g_strfreev (info->argv);
+      g_clear_pointer (&info->cpuset, (GDestroyNotify)g_array_unref);
+      g_clear_pointer (&info->log, gb_log_file_close);
+      g_ptr_array_unref (info->sockets);
+      g_ptr_array_unref (info->instances);
+      g_ptr_array_unref (info->standby);
+      g_array_unref (info->watches);
+      g_slice_free (GbLauncherInfo, info);
+    }
+}
+
+static GbLauncherInfo *
+gb_supervisor_get_launcher_info (GbSupervisor        *supervisor,
+                                 GSubprocessLauncher *launcher)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  GbLauncherInfo *info;
+
+  if (!(info = g_hash_table_lookup (priv->launchers, launcher)))
+    {
+      info = gb_launcher_info_new ();
+      info->supervisor = supervisor;
+      info->launcher = g_object_ref (launcher);
+      g_hash_table_insert (priv->launchers, g_object_ref (launcher), info);
+    }
+
+  return info;
+}
+
+static void
+gb_supervisor_write (GbSupervisor *supervisor,
+                     GIOChannel   *channel,
+                     const gchar  *str,
+                     gsize         len)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+
+  /*
+   * A supervisor on the other end of a socket may go away underneath us.
+   * Don't let that take the whole process down with SIGPIPE.
+   */
+  if (priv->shared || priv->reattached_channels)
+    {
+      if (send (g_io_channel_unix_get_fd (channel), str, len, MSG_NOSIGNAL) != len)
+        g_warning ("Lost the supervisor: %s", g_strerror (errno));
+    }
+  else
+    {
+      g_io_channel_write_chars (channel, str, len, NULL, NULL);
+      g_io_channel_flush (channel, NULL);
+    }
+}
+
+/*
+ * A pid always hashes to the same shard, so its removal lands in the
+ * table that holds it.
+ */
+static guint
+gb_supervisor_get_shard (GbSupervisor *supervisor,
+                         GPid          pid)
+{
+  return g_direct_hash (GINT_TO_POINTER (pid)) % supervisor->priv->channels->len;
+}
+
+/*
+ * Sends @mode for @pid to the shard holding it. A non-zero @tag is
+ * stored with the pid and handed to whoever reattaches; see
+ * gb_launcher_info_get_tag().
+ */
+static void
+gb_supervisor_send_command_full (GbSupervisor *supervisor,
+                                 gchar         mode,
+                                 GPid          pid,
+                                 guint         tag)
 {
   GbSupervisorPrivate *priv;
-  GString *str;
+  GIOChannel *channel;
+  gchar str[48];
+  gsize len;
 
   g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
-  g_return_if_fail (command);
 
   priv = supervisor->priv;
 
-  str = g_string_new (command);
-  g_string_append_c (str, '\n');
+  if (!priv->channels->len)
+    return;
+
+  channel = g_ptr_array_index (priv->channels,
+                               gb_supervisor_get_shard (supervisor, pid));
+
+  if (tag)
+    len = g_snprintf (str, sizeof str, "%c %u %u\n", mode, (guint)pid, tag);
+  else
+    len = g_snprintf (str, sizeof str, "%c %u\n", mode, (guint)pid);
+
+  gb_supervisor_write (supervisor, channel, str, len);
+}
+
+static void
+gb_supervisor_send_command (GbSupervisor *supervisor,
+                            gchar         mode,
+                            GPid          pid)
+{
+  gb_supervisor_send_command_full (supervisor, mode, pid, 0);
+}
+
+/*
+ * Sends @mode for each of @pids, with one write per COMMAND_BATCH bytes
+ * for each shard rather than one per pid.
+ */
+static void
+gb_supervisor_send_commands (GbSupervisor *supervisor,
+                             gchar         mode,
+                             const GPid   *pids,
+                             guint         n_pids)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  GString **batches;
+  guint shard;
+  guint i;
+
+  if (!priv->channels->len)
+    return;
+
+  batches = g_new0 (GString *, priv->channels->len);
+
+  for (i = 0; i < n_pids; i++)
+    {
+      shard = gb_supervisor_get_shard (supervisor, pids[i]);
+
+      if (!batches[shard])
+        batches[shard] = g_string_sized_new (COMMAND_BATCH);
+
+      g_string_append_printf (batches[shard], "%c %u\n", mode, (guint)pids[i]);
+
+      /*
+       * Leave room for one more command of at most 32 bytes.
+       */
+      if (batches[shard]->len >= COMMAND_BATCH - 32)
+        {
+          gb_supervisor_write (supervisor,
+                               g_ptr_array_index (priv->channels, shard),
+                               batches[shard]->str,
+                               batches[shard]->len);
+          g_string_truncate (batches[shard], 0);
+        }
+    }
+
+  for (shard = 0; shard < priv->channels->len; shard++)
+    {
+      if (!batches[shard])
+        continue;
+
+      if (batches[shard]->len)
+        gb_supervisor_write (supervisor,
+                             g_ptr_array_index (priv->channels, shard),
+                             batches[shard]->str,
+                             batches[shard]->len);
+
+      g_string_free (batches[shard], TRUE);
+    }
+
+  g_free (batches);
+}
+
+/*
+ * Identifies the launcher a child came from across a crash, so a new
+ * parent can count the children it takes over. Launchers are matched
+ * by their argv. The low bit marks parked spares.
+ */
+static guint
+gb_launcher_info_get_tag (GbLauncherInfo *info,
+                          gboolean        spare)
+{
+  return (info->tag << 1) | !!spare;
+}
+
+static void         gb_supervisor_arm            (GbLauncherInfo      *info);
+static GSubprocess *gb_supervisor_launch         (GbSupervisor        *supervisor,
+                                                  GSubprocessLauncher *launcher,
+                                                  GbLauncherInfo      *info);
+static gboolean     gb_supervisor_promote        (GbSupervisor        *supervisor,
+                                                  GbLauncherInfo      *info);
+static void         gb_supervisor_restart_exited (GbSupervisor        *supervisor,
+                                                  GSubprocess         *child);
+static gboolean     gb_supervisor_is_restarting  (GbSupervisor        *supervisor,
+                                                  GbLauncherInfo      *info);
+static void         gb_supervisor_scale          (GbSupervisor        *supervisor,
+                                                  GbLauncherInfo      *info,
+                                                  guint                n_instances);
+static gboolean     standby_cb                   (gpointer             user_data);
+
+/*
+ * Emits GbSupervisor::oom-killed if the kernel killed something in the
+ * cgroup of @child since we last looked at memory.events.
+ */
+static void
+gb_supervisor_check_oom (GbSupervisor *supervisor,
+                         GSubprocess  *child)
+{
+  const gchar *cgroup;
+  guint64 *seen;
+  guint64 count;
+
+  if (!(cgroup = g_object_get_data (G_OBJECT (child), "cgroup")))
+    return;
+
+  seen = g_object_get_data (G_OBJECT (child), "oom-kills");
+  count = gb_cgroup_read_event (cgroup, "memory.events", "oom_kill");
+
+  if (count > *seen)
+    {
+      *seen = count;
+      g_signal_emit (supervisor, gSignals[OOM_KILLED], 0,
+                     g_object_get_data (G_OBJECT (child), "launcher"),
+                     child);
+    }
+}
 
-  g_io_channel_write_chars (priv->channel, str->str, str->len, NULL, NULL);
-  g_io_channel_flush (priv->channel, NULL);
+static void
+memory_events_changed (GFileMonitor      *monitor,
+                       GFile             *file,
+                       GFile             *other_file,
+                       GFileMonitorEvent  event,
+                       gpointer           user_data)
+{
+  GSubprocess *child = user_data;
 
-  g_string_free (str, TRUE);
+  gb_supervisor_check_oom (g_object_get_data (G_OBJECT (child), "supervisor"),
+                           child);
 }
 
 static void
@@ -66,320 +468,3027 @@ wait_cb (GObject      *object,
          GAsyncResult *result,
          gpointer      user_data)
 {
-  GbSupervisor *supervisor = user_data;
-  GSubprocess *child = (GSubprocess *)object;
-  const gchar *identifier;
-  gboolean ret;
-  GError *error;
-  gchar *command;
+  GbSupervisor *supervisor = user_data;
+  GSubprocess *child = (GSubprocess *)object;
+  GbLauncherInfo *info;
+  const gchar *identifier;
+  const gchar *cgroup;
+  gboolean ret;
+  GError *error = NULL;
+
+  g_return_if_fail (G_IS_SUBPROCESS (child));
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+
+  ret = g_subprocess_wait_finish (child, result, &error);
+
+  if (!ret)
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+    }
+
+  identifier = g_object_get_data (G_OBJECT (child), "identifier");
+  gb_supervisor_send_command (supervisor, 'r', atoi (identifier));
+
+  /*
+   * Frozen children that die are simply forgotten, while terminated ones
+   * stay queued so they can be relaunched once pressure subsides.
+   */
+  if (GPOINTER_TO_INT (g_object_get_data (G_OBJECT (child), "shed")) ==
+      GB_SUPERVISOR_PRESSURE_FREEZE)
+    {
+      if (g_queue_remove (&supervisor->priv->shed, child))
+        g_object_unref (child);
+    }
+
+  info = g_hash_table_lookup (supervisor->priv->launchers,
+                              g_object_get_data (G_OBJECT (child), "launcher"));
+
+  /*
+   * An instance that was still counted died on its own rather than being
+   * retired. Hand its place to a parked spare right away. If none is
+   * ready, it is replaced a little later along with dead spares, so a
+   * broken binary cannot spin. Scaling launchers top themselves up.
+   */
+  if (info && g_ptr_array_remove_fast (info->instances, child))
+    {
+      if (supervisor->priv->running &&
+          !info->on_demand &&
+          !g_object_get_data (G_OBJECT (child), "shed") &&
+          !gb_supervisor_promote (supervisor, info) &&
+          info->n_standby &&
+          !info->standby_handler)
+        info->standby_handler = g_timeout_add_seconds (1, standby_cb, info);
+    }
+  else if (info && g_ptr_array_remove_fast (info->standby, child))
+    {
+      if (!info->standby_handler)
+        info->standby_handler = g_timeout_add_seconds (1, standby_cb, info);
+    }
+
+  gb_supervisor_restart_exited (supervisor, child);
+
+  /*
+   * Once an on-demand service goes away, the next connection starts it
+   * again.
+   */
+  if (info && info->active == child)
+    {
+      info->active = NULL;
+
+      if (supervisor->priv->running)
+        gb_supervisor_arm (info);
+    }
+
+  g_hash_table_remove (supervisor->priv->children,
+                       GINT_TO_POINTER (atoi (identifier)));
+
+  if ((cgroup = g_object_get_data (G_OBJECT (child), "cgroup")))
+    {
+      gb_supervisor_check_oom (supervisor, child);
+      g_object_set_data (G_OBJECT (child), "cgroup-monitor", NULL);
+      gb_cgroup_remove (cgroup);
+    }
+
+  g_object_unref (supervisor);
+}
+
+/*
+ * Picks the cpus the next child of @info is pinned to. Slots are counted
+ * per policy across all launchers, so launchers running a single
+ * instance each still spread out. Returns FALSE if the child should
+ * keep our mask.
+ */
+static gboolean
+gb_supervisor_place (GbSupervisor   *supervisor,
+                     GbLauncherInfo *info,
+                     cpu_set_t      *set)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  GArray *cpus;
+  guint slot;
+  guint cpu;
+  guint i;
+
+  if (info->placement == GB_SUPERVISOR_PLACEMENT_NONE)
+    return FALSE;
+
+  if (!priv->topology)
+    priv->topology = gb_cpu_topology_new ();
+
+  slot = priv->placement_slots[info->placement]++;
+
+  switch (info->placement) {
+    case GB_SUPERVISOR_PLACEMENT_ROUND_ROBIN:
+      cpus = gb_cpu_topology_get_cpu (priv->topology, slot);
+      break;
+    case GB_SUPERVISOR_PLACEMENT_PACK_L3:
+      cpus = gb_cpu_topology_get_l3 (priv->topology, slot);
+      break;
+    case GB_SUPERVISOR_PLACEMENT_SPREAD_NUMA:
+      cpus = gb_cpu_topology_get_node (priv->topology, slot);
+      break;
+    case GB_SUPERVISOR_PLACEMENT_CPUSET:
+      cpus = g_array_ref (info->cpuset);
+      break;
+    case GB_SUPERVISOR_PLACEMENT_NONE:
+    default:
+      g_assert_not_reached ();
+      return FALSE;
+  }
+
+  CPU_ZERO (set);
+
+  for (i = 0; i < cpus->len; i++)
+    {
+      cpu = g_array_index (cpus, guint, i);
+      if (cpu < CPU_SETSIZE)
+        CPU_SET (cpu, set);
+    }
+
+  g_array_unref (cpus);
+
+  return CPU_COUNT (set) > 0;
+}
+
+/*
+ * Called from the child between fork and exec.
+ */
+static void
+gb_supervisor_set_rlimit (gint    resource,
+                          guint64 value)
+{
+  struct rlimit rl;
+
+  if (!value)
+    return;
+
+  rl.rlim_cur = value;
+  rl.rlim_max = value;
+
+  setrlimit (resource, &rl);
+}
+
+/*
+ * Creates a cgroup for the next child next to our own, moving ourselves
+ * into a leaf the first time so the memory and cpu controllers can be
+ * enabled. The child does not exist yet, so the name cannot carry its
+ * pid.
+ */
+static gchar *
+gb_supervisor_create_cgroup (GbSupervisor *supervisor)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  GError *error = NULL;
+  gchar *cgroup;
+  gchar *name;
+
+  if (priv->cgroup_failed)
+    return NULL;
+
+  if (!priv->cgroup_root)
+    {
+      if (!(priv->cgroup_root = gb_cgroup_get_self ()) ||
+          !gb_cgroup_delegate (priv->cgroup_root, &error))
+        {
+          g_warning ("cgroup limits are unavailable: %s",
+                     error ? error->message : "cgroup2 is not mounted");
+          g_clear_error (&error);
+          g_clear_pointer (&priv->cgroup_root, g_free);
+          priv->cgroup_failed = TRUE;
+          return NULL;
+        }
+    }
+
+  name = g_strdup_printf ("%s-%u-%u",
+                          g_get_prgname (),
+                          (guint)getpid (),
+                          priv->cgroup_serial++);
+  cgroup = gb_cgroup_create (priv->cgroup_root, name, &error);
+  g_free (name);
+
+  if (!cgroup)
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+    }
+
+  return cgroup;
+}
+
+/*
+ * Returns a cgroup carrying the cgroup limits of @info for the next
+ * child to join, or %NULL if there are none or cgroups are unavailable.
+ */
+static gchar *
+gb_supervisor_prepare_cgroup (GbSupervisor   *supervisor,
+                              GbLauncherInfo *info)
+{
+  GError *error = NULL;
+  gchar *cgroup;
+  gchar *value;
+
+  if (!info->limits[GB_SUPERVISOR_LIMIT_MEMORY_MAX] &&
+      !info->limits[GB_SUPERVISOR_LIMIT_MEMORY_HIGH] &&
+      !info->limits[GB_SUPERVISOR_LIMIT_CPU_MAX])
+    return NULL;
+
+  if (!(cgroup = gb_supervisor_create_cgroup (supervisor)))
+    return NULL;
+
+  if (info->limits[GB_SUPERVISOR_LIMIT_MEMORY_MAX])
+    {
+      value = g_strdup_printf ("%"G_GUINT64_FORMAT,
+                               info->limits[GB_SUPERVISOR_LIMIT_MEMORY_MAX]);
+      gb_cgroup_write (cgroup, "memory.max", value, &error);
+      g_free (value);
+    }
+
+  if (!error && info->limits[GB_SUPERVISOR_LIMIT_MEMORY_HIGH])
+    {
+      value = g_strdup_printf ("%"G_GUINT64_FORMAT,
+                               info->limits[GB_SUPERVISOR_LIMIT_MEMORY_HIGH]);
+      gb_cgroup_write (cgroup, "memory.high", value, &error);
+      g_free (value);
+    }
+
+  /*
+   * cpu.max is a quota per 100ms period; the limit is in percent of a
+   * single cpu.
+   */
+  if (!error && info->limits[GB_SUPERVISOR_LIMIT_CPU_MAX])
+    {
+      value = g_strdup_printf ("%"G_GUINT64_FORMAT" 100000",
+                               info->limits[GB_SUPERVISOR_LIMIT_CPU_MAX] * 1000);
+      gb_cgroup_write (cgroup, "cpu.max", value, &error);
+      g_free (value);
+    }
+
+  if (error)
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+      gb_cgroup_remove (cgroup);
+      g_free (cgroup);
+      return NULL;
+    }
+
+  return cgroup;
+}
+
+static void
+gb_supervisor_limit (GbSupervisor   *supervisor,
+                     GbLauncherInfo *info,
+                     GSubprocess    *child,
+                     GPid            pid,
+                     gchar          *cgroup)
+{
+  GFileMonitor *monitor;
+  GError *error = NULL;
+  GFile *file;
+  gchar *path;
+
+  if (!cgroup)
+    return;
+
+  /*
+   * The child joined @cgroup itself before exec. Moving it again is a
+   * no-op then, and catches a child whose own write failed.
+   */
+  if (!gb_cgroup_attach (cgroup, pid, &error))
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+      gb_cgroup_remove (cgroup);
+      g_free (cgroup);
+      return;
+    }
+
+  g_object_set_data_full (G_OBJECT (child), "cgroup", cgroup, g_free);
+  g_object_set_data (G_OBJECT (child), "supervisor", supervisor);
+  g_object_set_data_full (G_OBJECT (child), "oom-kills",
+                          g_new0 (guint64, 1), g_free);
+
+  path = g_build_filename (cgroup, "memory.events", NULL);
+  file = g_file_new_for_path (path);
+  monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+
+  if (monitor)
+    {
+      g_signal_connect (monitor,
+                        "changed",
+                        G_CALLBACK (memory_events_changed),
+                        child);
+      g_object_set_data_full (G_OBJECT (child), "cgroup-monitor",
+                              monitor, g_object_unref);
+    }
+
+  g_object_unref (file);
+  g_free (path);
+}
+
+/*
+ * Runs in the child between fork and exec, so it may only make async
+ * signal safe calls. Joins the cgroup prepared for this spawn, pins the
+ * child and applies its rlimits before the program starts, so they hold
+ * from its first instruction and for every thread it creates. Then
+ * chains to the child setup given with gb_supervisor_set_child_setup().
+ * If the cgroup write fails, gb_supervisor_limit() still moves us from
+ * the parent.
+ */
+static void
+gb_supervisor_child_setup (gpointer user_data)
+{
+  GbLauncherInfo *info = user_data;
+  GbSupervisorPrivate *priv = info->supervisor->priv;
+
+  if (priv->procs_fd != -1)
+    {
+      while (write (priv->procs_fd, "0", 1) == -1 && errno == EINTR)
+        ;
+    }
+
+  if (priv->spawn_pinned)
+    sched_setaffinity (0, sizeof priv->spawn_cpus, &priv->spawn_cpus);
+
+  gb_supervisor_set_rlimit (RLIMIT_AS, info->limits[GB_SUPERVISOR_LIMIT_AS]);
+  gb_supervisor_set_rlimit (RLIMIT_NOFILE, info->limits[GB_SUPERVISOR_LIMIT_NOFILE]);
+  gb_supervisor_set_rlimit (RLIMIT_CPU, info->limits[GB_SUPERVISOR_LIMIT_CPU]);
+
+  if (info->child_setup)
+    info->child_setup (info->child_setup_data);
+}
+
+/*
+ * Services that are handed sockets need LISTEN_PID to match their own
+ * pid, which is only known after fork. Route them through a shell that
+ * exports it and then execs the real command in place.
+ */
+static gchar **
+gb_supervisor_build_argv (GbLauncherInfo *info)
+{
+  GPtrArray *argv;
+  guint i;
+
+  if (!info->sockets->len)
+    return g_strdupv (info->argv);
+
+  argv = g_ptr_array_new ();
+  g_ptr_array_add (argv, g_strdup ("/bin/sh"));
+  g_ptr_array_add (argv, g_strdup ("-c"));
+  g_ptr_array_add (argv, g_strdup ("LISTEN_PID=$$; export LISTEN_PID; "
+                                   "exec \"$0\" \"$@\""));
+
+  for (i = 0; info->argv[i]; i++)
+    g_ptr_array_add (argv, g_strdup (info->argv[i]));
+
+  g_ptr_array_add (argv, NULL);
+
+  return (gchar **)g_ptr_array_free (argv, FALSE);
+}
+
+static GSubprocess *
+gb_supervisor_launch (GbSupervisor        *supervisor,
+                      GSubprocessLauncher *launcher,
+                      GbLauncherInfo      *info)
+{
+  GbSupervisorPrivate *priv;
+  GSubprocess *child;
+  const gchar *identifier;
+  GError *error = NULL;
+  gchar *cgroup;
+  gchar **argv;
+  gint logfds[2] = { -1, -1 };
+
+  g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), NULL);
+
+  priv = supervisor->priv;
+
+  /*
+   * The child moves itself into its cgroup, pins itself and applies its
+   * rlimits before exec. See gb_supervisor_child_setup().
+   */
+  if ((cgroup = gb_supervisor_prepare_cgroup (supervisor, info)) &&
+      (priv->procs_fd = gb_cgroup_open_procs (cgroup, &error)) == -1)
+    {
+      g_warning ("%s", error->message);
+      g_clear_error (&error);
+    }
+
+  priv->spawn_pinned = gb_supervisor_place (supervisor, info, &priv->spawn_cpus);
+
+  if ((cgroup ||
+       priv->spawn_pinned ||
+       info->limits[GB_SUPERVISOR_LIMIT_AS] ||
+       info->limits[GB_SUPERVISOR_LIMIT_NOFILE] ||
+       info->limits[GB_SUPERVISOR_LIMIT_CPU]) &&
+      !info->child_setup_installed)
+    {
+      g_subprocess_launcher_set_child_setup (launcher,
+                                             gb_supervisor_child_setup,
+                                             info,
+                                             NULL);
+      info->child_setup_installed = TRUE;
+    }
+
+  /*
+   * Captured children share one pipe for stdout and stderr. The launcher
+   * only holds the write end for the duration of the spawn.
+   */
+  if (info->log && !g_unix_open_pipe (logfds, FD_CLOEXEC, &error))
+    {
+      g_warning ("%s", error->message);
+      g_clear_error (&error);
+    }
+
+  if (logfds[1] != -1)
+    {
+      g_subprocess_launcher_take_stdout_fd (launcher, logfds[1]);
+      g_subprocess_launcher_take_stderr_fd (launcher, dup (logfds[1]));
+    }
+
+  argv = gb_supervisor_build_argv (info);
+  child = g_subprocess_launcher_spawnv (launcher,
+                                        (const gchar * const *)argv,
+                                        &error);
+  g_strfreev (argv);
+
+  if (logfds[1] != -1)
+    {
+      g_subprocess_launcher_take_stdout_fd (launcher, -1);
+      g_subprocess_launcher_take_stderr_fd (launcher, -1);
+    }
+
+  if (priv->procs_fd != -1)
+    {
+      close (priv->procs_fd);
+      priv->procs_fd = -1;
+    }
+
+  priv->spawn_pinned = FALSE;
+
+  if (!child)
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+      if (logfds[0] != -1)
+        close (logfds[0]);
+      if (cgroup)
+        {
+          gb_cgroup_remove (cgroup);
+          g_free (cgroup);
+        }
+      return NULL;
+    }
+
+  identifier = g_subprocess_get_identifier (child);
+
+  gb_supervisor_limit (supervisor, info, child, atoi (identifier), cgroup);
+
+  if (logfds[0] != -1)
+    gb_log_file_attach (info->log, atoi (identifier), logfds[0]);
+
+  g_object_set_data_full (G_OBJECT (child),
+                          "identifier",
+                          g_strdup (identifier),
+                          g_free);
+
+  g_object_set_data_full (G_OBJECT (child),
+                          "launcher",
+                          g_object_ref (launcher),
+                          g_object_unref);
+
+  gb_supervisor_send_command_full (supervisor, 'a', atoi (identifier),
+                                   gb_launcher_info_get_tag (info, FALSE));
+
+  g_hash_table_insert (supervisor->priv->children,
+                       GINT_TO_POINTER (atoi (identifier)),
+                       g_object_ref (child));
+
+  g_ptr_array_add (info->instances, child);
+
+  /*
+   * Without sd_notify() support the child counts as ready once it has
+   * been spawned.
+   */
+  if (!info->notify_ready)
+    g_object_set_data (G_OBJECT (child), "ready", GINT_TO_POINTER (TRUE));
+
+  g_subprocess_wait_async (child,
+                           NULL,
+                           wait_cb,
+                           g_object_ref (supervisor));
+
+  g_object_unref (child);
+
+  return child;
+}
+
+static gboolean
+rearm_cb (gpointer user_data)
+{
+  GbLauncherInfo *info = user_data;
+
+  info->rearm_handler = 0;
+
+  if (info->supervisor->priv->running && info->on_demand && !info->active)
+    gb_supervisor_arm (info);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+socket_cb (gint         fd,
+           GIOCondition condition,
+           gpointer     user_data)
+{
+  GbLauncherInfo *info = user_data;
+
+  if (!info->active)
+    info->active = gb_supervisor_launch (info->supervisor,
+                                         info->launcher,
+                                         info);
+
+  /*
+   * Until the service accepts, the socket stays readable. Stop watching
+   * and let the service exiting arm us again. If it could not be
+   * started, try again with the next connection after a short delay so
+   * a broken binary cannot spin.
+   */
+  gb_launcher_info_disarm (info);
+
+  if (!info->active && !info->rearm_handler)
+    info->rearm_handler = g_timeout_add_seconds (1, rearm_cb, info);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gb_supervisor_arm (GbLauncherInfo *info)
+{
+  GSocket *socket;
+  guint handler;
+  guint i;
+
+  gb_launcher_info_disarm (info);
+
+  for (i = 0; i < info->sockets->len; i++)
+    {
+      socket = g_ptr_array_index (info->sockets, i);
+      handler = g_unix_fd_add (g_socket_get_fd (socket),
+                               G_IO_IN,
+                               socket_cb,
+                               info);
+      g_array_append_val (info->watches, handler);
+    }
+}
+
+/*
+ * Parks spares until @info has as many as requested. Spares see
+ * GB_SUPERVISOR_STANDBY=1 in their environment, initialize, send
+ * READY=1 and then wait for SIGUSR1 before doing any work.
+ */
+static void
+gb_supervisor_fill_standby (GbSupervisor   *supervisor,
+                            GbLauncherInfo *info)
+{
+  GSubprocess *spare;
+
+  if (!supervisor->priv->running || !info->argv || info->on_demand)
+    return;
+
+  g_subprocess_launcher_setenv (info->launcher,
+                                "GB_SUPERVISOR_STANDBY",
+                                "1",
+                                TRUE);
+
+  while (info->standby->len < info->n_standby)
+    {
+      if (!(spare = gb_supervisor_launch (supervisor, info->launcher, info)))
+        break;
+
+      g_ptr_array_remove_fast (info->instances, spare);
+      g_ptr_array_add (info->standby, spare);
+      g_object_set_data (G_OBJECT (spare), "ready", NULL);
+
+      gb_supervisor_send_command_full (supervisor, 'a',
+                                       atoi (g_object_get_data (G_OBJECT (spare),
+                                                                "identifier")),
+                                       gb_launcher_info_get_tag (info, TRUE));
+    }
+
+  g_subprocess_launcher_unsetenv (info->launcher, "GB_SUPERVISOR_STANDBY");
+}
+
+static gboolean
+standby_cb (gpointer user_data)
+{
+  GbLauncherInfo *info = user_data;
+  GbSupervisor *supervisor = info->supervisor;
+
+  info->standby_handler = 0;
+
+  /*
+   * Instances that died while no spare was ready are replaced here too,
+   * unless a restart or shedding accounts for them.
+   */
+  if (supervisor->priv->running &&
+      info->argv &&
+      !info->on_demand &&
+      g_queue_is_empty (&supervisor->priv->shed) &&
+      !gb_supervisor_is_restarting (supervisor, info))
+    gb_supervisor_scale (supervisor, info, info->n_instances);
+
+  gb_supervisor_fill_standby (supervisor, info);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Turns a ready spare into a counted instance. Failover costs a single
+ * signal, and a new spare is parked in the background.
+ */
+static gboolean
+gb_supervisor_promote (GbSupervisor   *supervisor,
+                       GbLauncherInfo *info)
+{
+  GSubprocess *spare;
+  guint i;
+
+  for (i = 0; i < info->standby->len; i++)
+    {
+      spare = g_ptr_array_index (info->standby, i);
+
+      if (g_object_get_data (G_OBJECT (spare), "ready") &&
+          !g_object_get_data (G_OBJECT (spare), "shed"))
+        {
+          g_ptr_array_remove_index_fast (info->standby, i);
+          g_ptr_array_add (info->instances, spare);
+          g_subprocess_send_signal (spare, SIGUSR1);
+          gb_supervisor_send_command_full (supervisor, 'a',
+                                           atoi (g_object_get_data (G_OBJECT (spare),
+                                                                    "identifier")),
+                                           gb_launcher_info_get_tag (info, FALSE));
+          gb_supervisor_fill_standby (supervisor, info);
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/*
+ * Retires one of the instances of @info taken over from a previous
+ * parent.
+ */
+static void
+gb_supervisor_retire_adopted (GbSupervisor   *supervisor,
+                              GbLauncherInfo *info)
+{
+  GbReattached *child;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, supervisor->priv->reattached);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      child = value;
+
+      if (child->info == info)
+        {
+          kill (child->pid, SIGTERM);
+          child->info = NULL;
+          info->n_adopted--;
+          return;
+        }
+    }
+}
+
+/*
+ * Spawns or retires instances until @info has @n_instances of them,
+ * counting those adopted by gb_supervisor_reattach(). Ready spares are
+ * promoted before anything new is spawned. Retired instances are sent
+ * SIGTERM and stop counting right away, adopted ones last.
+ */
+static void
+gb_supervisor_scale (GbSupervisor   *supervisor,
+                     GbLauncherInfo *info,
+                     guint           n_instances)
+{
+  GSubprocess *child;
+
+  while (info->instances->len + info->n_adopted < n_instances)
+    {
+      if (gb_supervisor_promote (supervisor, info))
+        continue;
+
+      if (!gb_supervisor_launch (supervisor, info->launcher, info))
+        break;
+    }
+
+  while (info->instances->len + info->n_adopted > n_instances)
+    {
+      if (!info->instances->len)
+        {
+          gb_supervisor_retire_adopted (supervisor, info);
+          continue;
+        }
+
+      child = g_ptr_array_remove_index (info->instances,
+                                        info->instances->len - 1);
+      g_subprocess_send_signal (child, SIGTERM);
+    }
+}
+
+static void
+gb_supervisor_start (GbSupervisor   *supervisor,
+                     GbLauncherInfo *info)
+{
+  if (info->on_demand)
+    gb_supervisor_arm (info);
+  else
+    {
+      gb_supervisor_scale (supervisor, info, info->n_instances);
+      gb_supervisor_fill_standby (supervisor, info);
+    }
+}
+
+static void
+gb_supervisor_restart_free (GbRestart *restart)
+{
+  if (restart->cancel_source)
+    {
+      g_source_destroy (restart->cancel_source);
+      g_source_unref (restart->cancel_source);
+    }
+
+  g_queue_foreach (&restart->old, (GFunc)g_object_unref, NULL);
+  g_queue_clear (&restart->old);
+  g_ptr_array_unref (restart->starting);
+  g_ptr_array_unref (restart->retiring);
+  g_slice_free (GbRestart, restart);
+}
+
+/*
+ * Retires the next old instance now that a replacement is ready.
+ */
+static void
+gb_supervisor_restart_swap (GbRestart *restart)
+{
+  GSubprocess *old;
+
+  if (!(old = g_queue_pop_head (&restart->old)))
+    return;
+
+  g_ptr_array_remove_fast (restart->info->instances, old);
+  g_ptr_array_add (restart->retiring, old);
+  g_subprocess_send_signal (old, SIGTERM);
+}
+
+/*
+ * Drops @task from the running restarts once it has returned. The task
+ * may outlive this while its callback is pending, so stop listening for
+ * cancellation right away.
+ */
+static void
+gb_supervisor_restart_complete (GbSupervisor *supervisor,
+                                GTask        *task)
+{
+  GbRestart *restart = g_task_get_task_data (task);
+
+  if (restart->cancel_source)
+    {
+      g_source_destroy (restart->cancel_source);
+      g_clear_pointer (&restart->cancel_source, g_source_unref);
+    }
+
+  g_ptr_array_remove (supervisor->priv->restarts, task);
+}
+
+/*
+ * Fails @task with @error. New instances that are not ready yet are
+ * retired and the launcher is brought back to its configured count,
+ * keeping whichever old instances are still serving.
+ */
+static void
+gb_supervisor_restart_abort (GbSupervisor *supervisor,
+                             GTask        *task,
+                             GError       *error)
+{
+  GbRestart *restart = g_task_get_task_data (task);
+  GbLauncherInfo *info = restart->info;
+  GSubprocess *child;
+
+  while (restart->starting->len)
+    {
+      child = g_ptr_array_index (restart->starting, restart->starting->len - 1);
+      g_ptr_array_remove_fast (info->instances, child);
+      g_subprocess_send_signal (child, SIGTERM);
+      g_ptr_array_remove_index (restart->starting, restart->starting->len - 1);
+    }
+
+  gb_supervisor_scale (supervisor, info, info->n_instances);
+
+  g_task_return_error (task, error);
+  gb_supervisor_restart_complete (supervisor, task);
+}
+
+static gboolean
+restart_cancelled_cb (GCancellable *cancellable,
+                      gpointer      user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+
+  g_cancellable_set_error_if_cancelled (cancellable, &error);
+  gb_supervisor_restart_abort (g_task_get_source_object (task), task, error);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gb_supervisor_restart_step (GbSupervisor *supervisor,
+                            GTask        *task)
+{
+  GbRestart *restart = g_task_get_task_data (task);
+  GbLauncherInfo *info = restart->info;
+  GSubprocess *child;
+  GError *error = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (g_task_get_cancellable (task),
+                                            &error))
+    {
+      gb_supervisor_restart_abort (supervisor, task, error);
+      return;
+    }
+
+  if (!restart->old.length &&
+      !restart->starting->len &&
+      !restart->retiring->len)
+    {
+      g_task_return_boolean (task, TRUE);
+      gb_supervisor_restart_complete (supervisor, task);
+      return;
+    }
+
+  if (!restart->batch_left &&
+      !restart->starting->len &&
+      !restart->retiring->len)
+    restart->batch_left = MIN (restart->batch_size, restart->old.length);
+
+  /*
+   * Every instance that is starting or retiring runs on top of the
+   * configured count, so together they are bounded by the surge limit.
+   */
+  while (restart->batch_left &&
+         restart->starting->len < restart->old.length &&
+         (restart->starting->len + restart->retiring->len) < restart->max_surge)
+    {
+      restart->batch_left--;
+
+      if (!(child = gb_supervisor_launch (supervisor, info->launcher, info)))
+        {
+          gb_supervisor_restart_abort (supervisor, task,
+                                       g_error_new (G_IO_ERROR,
+                                                    G_IO_ERROR_FAILED,
+                                                    _("Failed to spawn a new "
+                                                      "instance.")));
+          return;
+        }
+
+      if (g_object_get_data (G_OBJECT (child), "ready"))
+        gb_supervisor_restart_swap (restart);
+      else
+        g_ptr_array_add (restart->starting, g_object_ref (child));
+    }
+}
+
+static void
+gb_supervisor_restart_ready (GbSupervisor *supervisor,
+                             GSubprocess  *child)
+{
+  GbRestart *restart;
+  GTask *task;
+  guint i;
+
+  for (i = supervisor->priv->restarts->len; i > 0; i--)
+    {
+      task = g_ptr_array_index (supervisor->priv->restarts, i - 1);
+      restart = g_task_get_task_data (task);
+
+      if (g_ptr_array_remove_fast (restart->starting, child))
+        {
+          gb_supervisor_restart_swap (restart);
+          gb_supervisor_restart_step (supervisor, task);
+        }
+    }
+}
+
+static void
+gb_supervisor_restart_exited (GbSupervisor *supervisor,
+                              GSubprocess  *child)
+{
+  GbRestart *restart;
+  GTask *task;
+  guint i;
+
+  for (i = supervisor->priv->restarts->len; i > 0; i--)
+    {
+      task = g_ptr_array_index (supervisor->priv->restarts, i - 1);
+      restart = g_task_get_task_data (task);
+
+      if (g_ptr_array_remove_fast (restart->starting, child))
+        {
+          gb_supervisor_restart_abort (supervisor, task,
+                                       g_error_new (G_IO_ERROR,
+                                                    G_IO_ERROR_FAILED,
+                                                    _("A new instance exited "
+                                                      "before it became "
+                                                      "ready.")));
+        }
+      else if (g_ptr_array_remove_fast (restart->retiring, child))
+        {
+          gb_supervisor_restart_step (supervisor, task);
+        }
+      else if (g_queue_remove (&restart->old, child))
+        {
+          g_object_unref (child);
+          gb_supervisor_restart_step (supervisor, task);
+        }
+    }
+}
+
+static gboolean
+gb_supervisor_is_restarting (GbSupervisor   *supervisor,
+                             GbLauncherInfo *info)
+{
+  GbRestart *restart;
+  guint i;
+
+  for (i = 0; i < supervisor->priv->restarts->len; i++)
+    {
+      restart = g_task_get_task_data (g_ptr_array_index (supervisor->priv->restarts, i));
+
+      if (restart->info == info)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static guint
+instances_for_load (GbLauncherInfo *info,
+                    gdouble         per_instance)
+{
+  guint ret;
+
+  ret = info->load_avg / per_instance;
+
+  if (ret * per_instance < info->load_avg)
+    ret++;
+
+  return CLAMP (ret, info->min_instances, info->max_instances);
+}
+
+/*
+ * Runs every second for launchers with scaling enabled. The load the
+ * instances report is smoothed, capacity grows as soon as it exceeds the
+ * target and shrinks only once the cooldown has passed. Crashed
+ * instances are replaced on the same tick.
+ */
+static gboolean
+scale_cb (gpointer user_data)
+{
+  GbLauncherInfo *info = user_data;
+  GbSupervisor *supervisor = info->supervisor;
+  GSubprocess *child;
+  gdouble load = 0.0;
+  gint64 now;
+  guint wanted;
+  guint i;
+
+  /*
+   * Rolling restarts run a surge on top of the configured count and
+   * shed children must stay gone, so leave those launchers alone.
+   */
+  if (!supervisor->priv->running ||
+      !info->argv ||
+      info->on_demand ||
+      !g_queue_is_empty (&supervisor->priv->shed) ||
+      gb_supervisor_is_restarting (supervisor, info))
+    return G_SOURCE_CONTINUE;
+
+  for (i = 0; i < info->instances->len; i++)
+    {
+      child = g_ptr_array_index (info->instances, i);
+      load += GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (child), "load"));
+    }
+
+  info->load_avg = (info->load_avg * 0.7) + (load * 0.3);
+
+  now = g_get_monotonic_time ();
+  wanted = instances_for_load (info, info->target_load);
+
+  if (wanted < info->n_instances)
+    {
+      wanted = instances_for_load (info, info->target_load * SCALE_DOWN_HEADROOM);
+
+      if (wanted >= info->n_instances ||
+          (now - info->last_scale) < (info->cooldown * G_USEC_PER_SEC))
+        wanted = info->n_instances;
+    }
+
+  if (wanted != info->n_instances)
+    {
+      info->n_instances = wanted;
+      info->last_scale = now;
+    }
+
+  gb_supervisor_scale (supervisor, info, info->n_instances);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Receives sd_notify() datagrams. The sender is identified by the
+ * credentials the kernel attaches because of SO_PASSCRED.
+ */
+static gboolean
+notify_cb (gint         fd,
+           GIOCondition condition,
+           gpointer     user_data)
+{
+  GbSupervisor *supervisor = user_data;
+  union {
+    struct cmsghdr cmsg;
+    gchar buf[CMSG_SPACE (sizeof (struct ucred))];
+  } control;
+  struct cmsghdr *cmsg;
+  struct msghdr msg = { 0 };
+  struct ucred *ucred = NULL;
+  struct iovec iov;
+  GSubprocess *child;
+  gchar buf[4096];
+  gchar **lines;
+  gssize len;
+  guint i;
+
+  iov.iov_base = buf;
+  iov.iov_len = sizeof buf - 1;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = &control;
+  msg.msg_controllen = sizeof control;
+
+  if ((len = recvmsg (fd, &msg, MSG_DONTWAIT)) <= 0)
+    return G_SOURCE_CONTINUE;
+
+  buf[len] = '\0';
+
+  for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET &&
+          cmsg->cmsg_type == SCM_CREDENTIALS)
+        ucred = (struct ucred *)CMSG_DATA (cmsg);
+    }
+
+  if (!ucred ||
+      !(child = g_hash_table_lookup (supervisor->priv->children,
+                                     GINT_TO_POINTER (ucred->pid))))
+    return G_SOURCE_CONTINUE;
+
+  lines = g_strsplit (buf, "\n", 0);
+
+  for (i = 0; lines[i]; i++)
+    {
+      if (!g_strcmp0 (lines[i], "READY=1") &&
+          !g_object_get_data (G_OBJECT (child), "ready"))
+        {
+          g_object_set_data (G_OBJECT (child), "ready", GINT_TO_POINTER (TRUE));
+          gb_supervisor_restart_ready (supervisor, child);
+        }
+      else if (g_str_has_prefix (lines[i], "LOAD="))
+        {
+          g_object_set_data (G_OBJECT (child), "load",
+                             GUINT_TO_POINTER (MAX (0, atoi (lines[i] + 5))));
+        }
+    }
+
+  g_strfreev (lines);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+gb_supervisor_ensure_notify (GbSupervisor  *supervisor,
+                             GError       **error)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  struct sockaddr_un addr = { 0 };
+  gchar *name;
+  gint one = 1;
+  gint fd;
+
+  if (priv->notify_fd != -1)
+    return TRUE;
+
+  name = g_strdup_printf ("%s-%u.notify", g_get_prgname (), (guint)getpid ());
+  priv->notify_path = g_build_filename (g_get_user_runtime_dir (), name, NULL);
+  g_free (name);
+
+  addr.sun_family = AF_UNIX;
+
+  if (strlen (priv->notify_path) >= sizeof addr.sun_path)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_FAILED,
+                   _("Notify socket path is too long."));
+      g_clear_pointer (&priv->notify_path, g_free);
+      return FALSE;
+    }
+
+  strcpy (addr.sun_path, priv->notify_path);
+  unlink (priv->notify_path);
+
+  fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+  if (fd == -1 ||
+      setsockopt (fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof one) != 0 ||
+      bind (fd, (struct sockaddr *)&addr, sizeof addr) != 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "%s: %s", priv->notify_path, g_strerror (errno));
+      if (fd != -1)
+        close (fd);
+      g_clear_pointer (&priv->notify_path, g_free);
+      return FALSE;
+    }
+
+  priv->notify_fd = fd;
+  priv->notify_handler = g_unix_fd_add (fd, G_IO_IN, notify_cb, supervisor);
+
+  return TRUE;
+}
+
+static void
+gb_supervisor_clear_notify (GbSupervisor *supervisor)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+
+  if (priv->notify_handler)
+    {
+      g_source_remove (priv->notify_handler);
+      priv->notify_handler = 0;
+    }
+
+  if (priv->notify_fd != -1)
+    {
+      close (priv->notify_fd);
+      priv->notify_fd = -1;
+    }
+
+  if (priv->notify_path)
+    {
+      unlink (priv->notify_path);
+      g_clear_pointer (&priv->notify_path, g_free);
+    }
+}
+
+static GbSupervisorPriority
+gb_supervisor_get_priority (GbSupervisor *supervisor,
+                            GSubprocess  *child)
+{
+  GbLauncherInfo *info;
+
+  info = g_hash_table_lookup (supervisor->priv->launchers,
+                              g_object_get_data (G_OBJECT (child), "launcher"));
+
+  return info ? info->priority : GB_SUPERVISOR_PRIORITY_NORMAL;
+}
+
+static gboolean
+gb_supervisor_is_spare (GbSupervisor *supervisor,
+                        GSubprocess  *child)
+{
+  GbLauncherInfo *info;
+  guint i;
+
+  info = g_hash_table_lookup (supervisor->priv->launchers,
+                              g_object_get_data (G_OBJECT (child), "launcher"));
+
+  if (info)
+    {
+      for (i = 0; i < info->standby->len; i++)
+        if (g_ptr_array_index (info->standby, i) == (gpointer)child)
+          return TRUE;
+    }
+
+  return FALSE;
+}
+
+/*
+ * Freezes or terminates the lowest priority child that has not been shed
+ * yet. Critical children are never touched, and neither are parked
+ * spares, which would otherwise come back as counted instances.
+ */
+static gboolean
+gb_supervisor_shed_one (GbSupervisor *supervisor)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  GbSupervisorPriority priority;
+  GbSupervisorPriority lowest = GB_SUPERVISOR_PRIORITY_CRITICAL;
+  GHashTableIter iter;
+  GSubprocess *victim = NULL;
+  const gchar *cgroup;
+  gpointer key;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, priv->children);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (g_object_get_data (value, "shed") ||
+          gb_supervisor_is_spare (supervisor, value))
+        continue;
+
+      priority = gb_supervisor_get_priority (supervisor, value);
+
+      if (priority < lowest)
+        {
+          lowest = priority;
+          victim = value;
+        }
+    }
+
+  if (!victim)
+    return FALSE;
+
+  g_object_set_data (G_OBJECT (victim), "shed",
+                     GINT_TO_POINTER (priv->pressure_action));
+  g_queue_push_tail (&priv->shed, g_object_ref (victim));
+
+  if (priv->pressure_action == GB_SUPERVISOR_PRESSURE_TERMINATE)
+    {
+      g_subprocess_send_signal (victim, SIGTERM);
+      return TRUE;
+    }
+
+  if ((cgroup = g_object_get_data (G_OBJECT (victim), "cgroup")))
+    gb_cgroup_write (cgroup, "cgroup.freeze", "1", NULL);
+  else
+    g_subprocess_send_signal (victim, SIGSTOP);
+
+  /*
+   * A frozen child ignores SIGTERM, so tell its reaper to kill it
+   * outright should we die before thawing it.
+   */
+  gb_supervisor_send_command (supervisor, 'f',
+                              atoi (g_object_get_data (G_OBJECT (victim),
+                                                       "identifier")));
+
+  return TRUE;
+}
+
+/*
+ * Resumes a child frozen by gb_supervisor_shed_one().
+ */
+static void
+gb_supervisor_thaw (GbSupervisor *supervisor,
+                    GSubprocess  *child)
+{
+  const gchar *cgroup;
+
+  g_object_set_data (G_OBJECT (child), "shed", NULL);
+
+  if ((cgroup = g_object_get_data (G_OBJECT (child), "cgroup")))
+    gb_cgroup_write (cgroup, "cgroup.freeze", "0", NULL);
+  else
+    g_subprocess_send_signal (child, SIGCONT);
+
+  gb_supervisor_send_command (supervisor, 't',
+                              atoi (g_object_get_data (G_OBJECT (child),
+                                                       "identifier")));
+}
+
+/*
+ * Brings back the most recently shed child, which is also the one with
+ * the highest priority.
+ */
+static void
+gb_supervisor_restore_one (GbSupervisor *supervisor)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  GSubprocessLauncher *launcher;
+  GbLauncherInfo *info;
+  GSubprocess *child;
+
+  if (!(child = g_queue_pop_tail (&priv->shed)))
+    return;
+
+  if (GPOINTER_TO_INT (g_object_get_data (G_OBJECT (child), "shed")) ==
+      GB_SUPERVISOR_PRESSURE_TERMINATE)
+    {
+      launcher = g_object_get_data (G_OBJECT (child), "launcher");
+      info = g_hash_table_lookup (priv->launchers, launcher);
+
+      if (info && info->argv && priv->running)
+        gb_supervisor_launch (supervisor, launcher, info);
+    }
+  else
+    {
+      gb_supervisor_thaw (supervisor, child);
+    }
+
+  g_object_unref (child);
+}
+
+/*
+ * Returns the "some avg10" value of the pressure file, in percent.
+ */
+static gdouble
+read_pressure_avg10 (const gchar *path)
+{
+  gchar *contents = NULL;
+  gdouble ret = 0.0;
+  gchar *avg;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return 0.0;
+
+  if (g_str_has_prefix (contents, "some ") &&
+      (avg = strstr (contents, "avg10=")))
+    ret = g_ascii_strtod (avg + strlen ("avg10="), NULL);
+
+  g_free (contents);
+
+  return ret;
+}
+
+static gboolean
+restore_cb (gpointer user_data)
+{
+  GbSupervisor *supervisor = user_data;
+  GbSupervisorPrivate *priv = supervisor->priv;
+
+  if (read_pressure_avg10 (priv->pressure_path) < priv->pressure_restore)
+    gb_supervisor_restore_one (supervisor);
+
+  if (g_queue_is_empty (&priv->shed))
+    {
+      priv->restore_handler = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+pressure_cb (gint         fd,
+             GIOCondition condition,
+             gpointer     user_data)
+{
+  GbSupervisor *supervisor = user_data;
+  GbSupervisorPrivate *priv = supervisor->priv;
+
+  if (condition & G_IO_ERR)
+    {
+      g_warning ("Memory pressure trigger was removed.");
+      priv->pressure_handler = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  if (gb_supervisor_shed_one (supervisor) && !priv->restore_handler)
+    priv->restore_handler = g_timeout_add_seconds (1, restore_cb, supervisor);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+gb_supervisor_clear_pressure (GbSupervisor *supervisor)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+
+  if (priv->pressure_handler)
+    {
+      g_source_remove (priv->pressure_handler);
+      priv->pressure_handler = 0;
+    }
+
+  if (priv->restore_handler)
+    {
+      g_source_remove (priv->restore_handler);
+      priv->restore_handler = 0;
+    }
+
+  if (priv->pressure_fd != -1)
+    {
+      close (priv->pressure_fd);
+      priv->pressure_fd = -1;
+    }
+
+  g_clear_pointer (&priv->pressure_path, g_free);
+}
+
+static void
+gb_supervisor_add_channel (GbSupervisor *supervisor,
+                           gint          fd)
+{
+  GIOChannel *channel;
+
+  channel = g_io_channel_unix_new (fd);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+  g_ptr_array_add (supervisor->priv->channels, channel);
+}
+
+/*
+ * Starts the registered launchers and replays the pids added before the
+ * supervisor was running.
+ */
+static void
+gb_supervisor_attach (GbSupervisor *supervisor)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  priv->running = TRUE;
+
+  g_hash_table_iter_init (&iter, priv->launchers);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (((GbLauncherInfo *)value)->argv)
+        gb_supervisor_start (supervisor, value);
+    }
+
+  gb_supervisor_send_commands (supervisor, 'a',
+                               (const GPid *)priv->pids->data,
+                               priv->pids->len);
+}
+
+static gchar *
+gb_supervisor_get_grace_path (GbSupervisor *supervisor,
+                              guint         shard)
+{
+  gchar *name;
+  gchar *path;
+
+  name = g_strdup_printf ("%s-%u.supervisor", supervisor->priv->grace_name, shard);
+  path = g_build_filename (g_get_user_runtime_dir (), name, NULL);
+  g_free (name);
+
+  return path;
+}
+
+static gboolean
+send_batch (gint    fd,
+            guint32 *pids,
+            gint    *pidfds,
+            guint    n_pids)
+{
+  union {
+    struct cmsghdr cmsg;
+    gchar buf[CMSG_SPACE (sizeof (gint) * HANDOVER_BATCH)];
+  } control;
+  struct msghdr msg = { 0 };
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+
+  iov.iov_base = pids;
+  iov.iov_len = n_pids * 2 * sizeof (guint32);
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (pidfds)
+    {
+      msg.msg_control = &control;
+      msg.msg_controllen = CMSG_SPACE (sizeof (gint) * n_pids);
+
+      cmsg = CMSG_FIRSTHDR (&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN (sizeof (gint) * n_pids);
+      memcpy (CMSG_DATA (cmsg), pidfds, sizeof (gint) * n_pids);
+    }
+
+  return sendmsg (fd, &msg, MSG_NOSIGNAL) == (gssize)iov.iov_len;
+}
+
+/*
+ * Terminates @pid on behalf of a parent that went away. A stopped child
+ * only acts on SIGTERM once continued, and one frozen through its cgroup
+ * only reacts to SIGKILL.
+ */
+static void
+gb_supervisor_shard_reap (GPid     pid,
+                          gboolean frozen)
+{
+  g_printerr ("Reaping %u\n", (guint)pid);
+  kill (pid, SIGTERM);
+  kill (pid, SIGCONT);
+
+  if (frozen)
+    kill (pid, SIGKILL);
+}
+
+/*
+ * Sends every child that is still alive to the new parent, each as a
+ * pid and launcher tag pair along with a pidfd so it can watch for exits
+ * without being the real parent. Children that died in the meantime are
+ * forgotten. A lone zero pair ends the list.
+ */
+static gboolean
+gb_supervisor_shard_hand_over (gint        fd,
+                               GHashTable *pids,
+                               GHashTable *frozen)
+{
+  GHashTableIter iter;
+  guint32 batch[HANDOVER_BATCH * 2];
+  gint pidfds[HANDOVER_BATCH];
+  gboolean ret = TRUE;
+  gpointer key;
+  gpointer value;
+  guint n_pids = 0;
+  guint i;
+
+  g_hash_table_iter_init (&iter, pids);
+  while (ret && g_hash_table_iter_next (&iter, &key, &value))
+    {
+      /*
+       * Only the parent that froze a child knows how to thaw it, so a
+       * frozen child is reaped rather than handed over.
+       */
+      if (g_hash_table_contains (frozen, key))
+        {
+          gb_supervisor_shard_reap (GPOINTER_TO_INT (key), TRUE);
+          g_hash_table_remove (frozen, key);
+          g_hash_table_iter_remove (&iter);
+          continue;
+        }
+
+      pidfds[n_pids] = syscall (SYS_pidfd_open, GPOINTER_TO_INT (key), 0);
+
+      if (pidfds[n_pids] == -1)
+        {
+          g_hash_table_iter_remove (&iter);
+          continue;
+        }
+
+      batch[n_pids * 2] = GPOINTER_TO_UINT (key);
+      batch[n_pids * 2 + 1] = GPOINTER_TO_UINT (value);
+      n_pids++;
+
+      if (n_pids == HANDOVER_BATCH)
+        {
+          ret = send_batch (fd, batch, pidfds, n_pids);
+          for (i = 0; i < n_pids; i++)
+            close (pidfds[i]);
+          n_pids = 0;
+        }
+    }
+
+  if (ret && n_pids)
+    ret = send_batch (fd, batch, pidfds, n_pids);
+
+  for (i = 0; i < n_pids; i++)
+    close (pidfds[i]);
+
+  batch[0] = 0;
+  batch[1] = 0;
+
+  return ret && send_batch (fd, batch, NULL, 1);
+}
+
+/*
+ * Keeps the children of a vanished parent alive for the grace period
+ * while listening for a new parent. Returns the connection to it, or -1
+ * if nobody reattached in time.
+ */
+static gint
+gb_supervisor_shard_linger (GbSupervisor *supervisor,
+                            guint         shard,
+                            GHashTable   *pids,
+                            GHashTable   *frozen)
+{
+  struct sockaddr_un addr = { 0 };
+  struct pollfd pfd;
+  struct ucred cred;
+  socklen_t len;
+  gint64 deadline;
+  gint64 now;
+  gchar *path;
+  gint listen_fd;
+  gint ret = -1;
+  gint fd;
+
+  path = gb_supervisor_get_grace_path (supervisor, shard);
+
+  addr.sun_family = AF_UNIX;
+
+  if (strlen (path) >= sizeof addr.sun_path)
+    {
+      g_free (path);
+      return -1;
+    }
+
+  strcpy (addr.sun_path, path);
+  unlink (path);
+  umask (0077);
+
+  listen_fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+  if (listen_fd == -1 ||
+      bind (listen_fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+      listen (listen_fd, 1) != 0)
+    goto cleanup;
+
+  deadline = g_get_monotonic_time () +
+             (supervisor->priv->grace_period * G_USEC_PER_SEC);
+
+  while ((now = g_get_monotonic_time ()) < deadline)
+    {
+      pfd.fd = listen_fd;
+      pfd.events = POLLIN;
+
+      if (poll (&pfd, 1, ((deadline - now) / 1000) + 1) <= 0)
+        continue;
+
+      if (-1 == (fd = accept4 (listen_fd, NULL, NULL, SOCK_CLOEXEC)))
+        continue;
+
+      len = sizeof cred;
+
+      if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+          cred.uid == getuid () &&
+          gb_supervisor_shard_hand_over (fd, pids, frozen))
+        {
+          ret = fd;
+          break;
+        }
+
+      close (fd);
+    }
+
+cleanup:
+  if (listen_fd != -1)
+    close (listen_fd);
+  unlink (path);
+  g_free (path);
+
+  return ret;
+}
+
+/*
+ * Body of a supervisor shard. Tracks the pids routed to it until the
+ * parent goes away, then reaps them. With a grace period, a new parent
+ * may take them over first.
+ */
+static void
+gb_supervisor_shard_main (GbSupervisor *supervisor,
+                          guint         shard,
+                          gint          fd)
+{
+  GIOChannel *channel;
+  GHashTableIter iter;
+  GHashTable *frozen;
+  GHashTable *pids;
+  GIOStatus status;
+  GString *str;
+  gpointer key;
+  gchar mode;
+  guint tag;
+  GPid pid;
+
+  channel = g_io_channel_unix_new (fd);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+
+  str = g_string_new (NULL);
+  pids = g_hash_table_new (g_direct_hash, g_direct_equal);
+  frozen = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+again:
+  status = g_io_channel_read_line_string (channel, str, NULL, NULL);
+
+  if (status != G_IO_STATUS_NORMAL)
+    {
+      goto linger;
+    }
+
+  tag = 0;
+
+  if (2 > sscanf (str->str, "%c %u %u", &mode, &pid, &tag))
+    {
+      goto kill_targets;
+    }
+
+  switch (mode) {
+    case 'a':
+      g_hash_table_insert (pids, GINT_TO_POINTER (pid), GUINT_TO_POINTER (tag));
+      break;
+    case 'r':
+      g_hash_table_remove (pids, GINT_TO_POINTER (pid));
+      g_hash_table_remove (frozen, GINT_TO_POINTER (pid));
+      break;
+    case 'f':
+      if (g_hash_table_contains (pids, GINT_TO_POINTER (pid)))
+        g_hash_table_add (frozen, GINT_TO_POINTER (pid));
+      break;
+    case 't':
+      g_hash_table_remove (frozen, GINT_TO_POINTER (pid));
+      break;
+    default:
+      /*
+       * This includes "q", which gb_supervisor_shutdown() sends so that
+       * a deliberate shutdown never waits out the grace period.
+       */
+      goto kill_targets;
+    }
+
+  goto again;
+
+linger:
+
+  g_io_channel_unref (channel);
+
+  if (supervisor->priv->grace_period &&
+      -1 != (fd = gb_supervisor_shard_linger (supervisor, shard, pids, frozen)))
+    {
+      channel = g_io_channel_unix_new (fd);
+      g_io_channel_set_close_on_unref (channel, TRUE);
+      goto again;
+    }
+
+kill_targets:
+
+  g_hash_table_iter_init (&iter, pids);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    gb_supervisor_shard_reap (GPOINTER_TO_INT (key),
+                              g_hash_table_contains (frozen, key));
+
+  exit (EXIT_SUCCESS);
+}
+
+static gboolean
+gb_supervisor_fork_shard (GbSupervisor  *supervisor,
+                          GError       **error)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  GIOChannel *channel;
+  gchar *name;
+  GPid pid;
+  gint pipefds[2];
+  gint ret;
+  guint i;
+
+  /*
+   * Make a pipe that we can use to detect the parent process has
+   * exited.
+   */
+  errno = 0;
+  ret = pipe (pipefds);
+
+  if (ret != 0)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   G_FILE_ERROR_IO,
+                   strerror (errno));
+      return FALSE;
+    }
+
+  /*
+   * Fork a child process that will do the monitoring.
+   */
+  errno = 0;
+  pid = fork ();
+
+  if (pid == -1)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   G_FILE_ERROR_IO,
+                   strerror (errno));
+      close (pipefds[0]);
+      close (pipefds[1]);
+      return FALSE;
+    }
+
+  /*
+   * If we are the parent process, setup our communication channel
+   * and then we are done.
+   */
+  if (pid)
+    {
+      g_array_append_val (priv->shards, pid);
+      close (pipefds[0]);
+      gb_supervisor_add_channel (supervisor, pipefds[1]);
+      return TRUE;
+    }
+
+  /*
+   * Rename the process to make it easier to find in `top'.
+   */
+  if (priv->n_shards > 1)
+    name = g_strdup_printf ("%s-supervisor-%u",
+                            g_get_prgname (),
+                            priv->shards->len);
+  else
+    name = g_strdup_printf ("%s-supervisor", g_get_prgname ());
+  g_set_prgname (name);
+  g_free (name);
+
+  /*
+   * Drop the write ends held for earlier shards. Otherwise they would
+   * only see EOF once this shard exited, serializing shutdown.
+   *
+   * TODO: Close all file-descriptors except pipefds[0].
+   */
+  for (i = 0; i < priv->channels->len; i++)
+    {
+      channel = g_ptr_array_index (priv->channels, i);
+      close (g_io_channel_unix_get_fd (channel));
+    }
+
+  close (pipefds[1]);
+
+  gb_supervisor_shard_main (supervisor, priv->shards->len, pipefds[0]);
+
+  return TRUE;
+}
+
+static void
+gb_reattached_free (GbReattached *child)
+{
+  if (child->handler)
+    g_source_remove (child->handler);
+
+  if (child->info)
+    child->info->n_adopted--;
+
+  close (child->pidfd);
+  g_slice_free (GbReattached, child);
+}
+
+/*
+ * A pidfd becomes readable once its process exits.
+ */
+static gboolean
+reattached_exited_cb (gint         fd,
+                      GIOCondition condition,
+                      gpointer     user_data)
+{
+  GbReattached *child = user_data;
+  GbSupervisor *supervisor = child->supervisor;
+  GbLauncherInfo *info = child->info;
+
+  child->handler = 0;
+
+  gb_supervisor_send_command (supervisor, 'r', child->pid);
+  g_hash_table_remove (supervisor->priv->reattached,
+                       GINT_TO_POINTER (child->pid));
+
+  /*
+   * An adopted instance is replaced like one of our own, from the
+   * delayed timer.
+   */
+  if (info &&
+      supervisor->priv->running &&
+      !info->on_demand &&
+      !info->standby_handler)
+    info->standby_handler = g_timeout_add_seconds (1, standby_cb, info);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gb_supervisor_track_reattached (GbSupervisor *supervisor,
+                                GPid          pid,
+                                guint         tag,
+                                gint          pidfd)
+{
+  GbReattached *child;
+
+  child = g_slice_new0 (GbReattached);
+  child->supervisor = supervisor;
+  child->pid = pid;
+  child->tag = tag;
+  child->pidfd = pidfd;
+  child->handler = g_unix_fd_add (pidfd, G_IO_IN, reattached_exited_cb, child);
+
+  g_hash_table_replace (supervisor->priv->reattached,
+                        GINT_TO_POINTER (pid),
+                        child);
+
+  g_signal_emit (supervisor, gSignals[REATTACHED], 0, pid, pidfd);
+}
+
+/*
+ * Reads the children a lingering shard hands over, as sent by
+ * gb_supervisor_shard_hand_over().
+ */
+static gboolean
+gb_supervisor_receive_children (GbSupervisor  *supervisor,
+                                gint           fd,
+                                GError       **error)
+{
+  union {
+    struct cmsghdr cmsg;
+    gchar buf[CMSG_SPACE (sizeof (gint) * HANDOVER_BATCH)];
+  } control;
+  guint32 batch[HANDOVER_BATCH * 2];
+  gint pidfds[HANDOVER_BATCH];
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  gssize len;
+  guint n_pids;
+  guint n_fds;
+  guint i;
+
+  for (;;)
+    {
+      memset (&msg, 0, sizeof msg);
+
+      iov.iov_base = batch;
+      iov.iov_len = sizeof batch;
+
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = &control;
+      msg.msg_controllen = sizeof control;
+
+      if ((len = recvmsg (fd, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_CONNECTION_CLOSED,
+                       _("The supervisor went away while handing over "
+                         "its children."));
+          return FALSE;
+        }
+
+      n_pids = len / (2 * sizeof (guint32));
+      n_fds = 0;
+
+      for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+        {
+          if (cmsg->cmsg_level == SOL_SOCKET &&
+              cmsg->cmsg_type == SCM_RIGHTS)
+            {
+              n_fds = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (gint);
+              memcpy (pidfds, CMSG_DATA (cmsg), n_fds * sizeof (gint));
+            }
+        }
+
+      if (n_pids == 1 && batch[0] == 0 && !n_fds)
+        return TRUE;
+
+      for (i = 0; i < n_fds; i++)
+        {
+          if (i < n_pids)
+            gb_supervisor_track_reattached (supervisor,
+                                            batch[i * 2],
+                                            batch[i * 2 + 1],
+                                            pidfds[i]);
+          else
+            close (pidfds[i]);
+        }
+    }
+}
+
+gboolean
+gb_supervisor_run (GbSupervisor *supervisor,
+                   GError      **error)
+{
+  GbSupervisorPrivate *priv;
+  gint fd;
+  guint i;
+
+  g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), FALSE);
+
+  priv = supervisor->priv;
+
+  /*
+   * In shared mode a single per-user supervisor watches every client
+   * over its own connection instead of each process forking one.
+   */
+  if (g_getenv ("GB_SUPERVISOR_SHARED"))
+    {
+      if (-1 == (fd = gb_supervisor_daemon_connect (error)))
+        return FALSE;
+
+      priv->shared = TRUE;
+      gb_supervisor_add_channel (supervisor, fd);
+      gb_supervisor_attach (supervisor);
+      return TRUE;
+    }
+
+  for (i = 0; i < priv->n_shards; i++)
+    {
+      if (!gb_supervisor_fork_shard (supervisor, error))
+        {
+          gb_supervisor_shutdown (supervisor);
+          return FALSE;
+        }
+    }
+
+  gb_supervisor_attach (supervisor);
+
+  return TRUE;
+}
+
+void
+gb_supervisor_add_pid (GbSupervisor *supervisor,
+                       GPid          pid)
+{
+  GbSupervisorPrivate *priv;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (pid);
+
+  priv = supervisor->priv;
+
+  if (priv->running)
+    {
+      gb_supervisor_send_command (supervisor, 'a', pid);
+    } else{
+      g_array_append_val (priv->pids, pid);
+    }
+}
+
+void
+gb_supervisor_remove_pid (GbSupervisor *supervisor,
+                          GPid          pid)
+{
+  GbSupervisorPrivate *priv;
+  guint i;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (pid);
+
+  priv = supervisor->priv;
+
+  if (priv->running)
+    {
+      gb_supervisor_send_command (supervisor, 'r', pid);
+      return;
+    }
+
+  for (i = 0; i < priv->pids->len; i++)
+    {
+      if (g_array_index (priv->pids, GPid, i) == pid)
+        {
+          g_array_remove_index_fast (priv->pids, i);
+          break;
+        }
+    }
+}
+
+/*
+ * Like gb_supervisor_add_pid() for many pids at once. The shards are
+ * told with a few large writes instead of one per pid.
+ */
+void
+gb_supervisor_add_pids (GbSupervisor *supervisor,
+                        const GPid   *pids,
+                        guint         n_pids)
+{
+  GbSupervisorPrivate *priv;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (pids || !n_pids);
+
+  priv = supervisor->priv;
+
+  if (priv->running)
+    gb_supervisor_send_commands (supervisor, 'a', pids, n_pids);
+  else
+    g_array_append_vals (priv->pids, pids, n_pids);
+}
+
+/*
+ * Like gb_supervisor_remove_pid() for many pids at once.
+ */
+void
+gb_supervisor_remove_pids (GbSupervisor *supervisor,
+                           const GPid   *pids,
+                           guint         n_pids)
+{
+  guint i;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (pids || !n_pids);
+
+  if (supervisor->priv->running)
+    {
+      gb_supervisor_send_commands (supervisor, 'r', pids, n_pids);
+      return;
+    }
+
+  for (i = 0; i < n_pids; i++)
+    gb_supervisor_remove_pid (supervisor, pids[i]);
+}
+
+void
+gb_supervisor_add_subprocess (GbSupervisor *supervisor,
+                              GSubprocess  *subprocess)
+{
+  const gchar *identifier;
+  guint64 val;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+
+  identifier = g_subprocess_get_identifier (subprocess);
+
+  if (1 == sscanf (identifier, "%"G_GUINT64_FORMAT, &val))
+    {
+      gb_supervisor_add_pid (supervisor, (GPid)val);
+    } else{
+      g_warning ("Failed to parse pid %s", identifier);
+    }
+}
+
+static void
+gb_supervisor_dispose (GObject *object)
+{
+  GbSupervisorPrivate *priv = GB_SUPERVISOR (object)->priv;
+
+  gb_supervisor_clear_pressure (GB_SUPERVISOR (object));
+  gb_supervisor_clear_notify (GB_SUPERVISOR (object));
+
+  g_clear_pointer (&priv->restarts, (GDestroyNotify)g_ptr_array_unref);
+
+  g_queue_foreach (&priv->shed, (GFunc)g_object_unref, NULL);
+  g_queue_clear (&priv->shed);
+
+  g_clear_pointer (&priv->children, (GDestroyNotify)g_hash_table_unref);
+  g_clear_pointer (&priv->reattached, (GDestroyNotify)g_hash_table_unref);
+  g_clear_pointer (&priv->launchers, (GDestroyNotify)g_hash_table_unref);
+
+  G_OBJECT_CLASS (gb_supervisor_parent_class)->dispose (object);
+}
+
+/*
+ * Supervises processes spawned from @launcher with @argv. Limits and
+ * placement may install a child setup function on @launcher, replacing
+ * one set with g_subprocess_launcher_set_child_setup(); pass yours to
+ * gb_supervisor_set_child_setup() instead.
+ */
+void
+gb_supervisor_add_launcher (GbSupervisor        *supervisor,
+                            GSubprocessLauncher *launcher,
+                            const gchar *const  *argv)
+{
+  GbSupervisorPrivate *priv;
+  GbLauncherInfo *info;
+  guint i;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
+
+  priv = supervisor->priv;
+
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+  g_strfreev (info->argv);
+  info->argv = g_strdupv ((gchar **)argv);
+
+  /*
+   * Keep one bit free for gb_launcher_info_get_tag() and never use zero,
+   * which stands for pids added with gb_supervisor_add_pid().
+   */
+  info->tag = 0;
+  for (i = 0; argv && argv[i]; i++)
+    info->tag = (info->tag * 31) + g_str_hash (argv[i]);
+  info->tag = MAX (info->tag & G_MAXINT, 1);
+
+  if (priv->running)
+    {
+      gb_supervisor_start (supervisor, info);
+    }
+}
+
+/*
+ * Hands @socket to every process spawned from @launcher using the
+ * LISTEN_FDS protocol. Sockets are numbered from fd 3 in the order they
+ * are added. GSocket keeps its descriptor non-blocking and the service
+ * shares that file description, so it should expect EAGAIN from accept.
+ */
+void
+gb_supervisor_add_socket (GbSupervisor        *supervisor,
+                          GSubprocessLauncher *launcher,
+                          GSocket             *socket)
+{
+  GbLauncherInfo *info;
+  gchar *value;
+  gint fd;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
+  g_return_if_fail (G_IS_SOCKET (socket));
+
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+
+  if (-1 == (fd = dup (g_socket_get_fd (socket))))
+    {
+      g_warning ("Failed to dup socket: %s", g_strerror (errno));
+      return;
+    }
+
+  g_subprocess_launcher_take_fd (launcher, fd, 3 + info->sockets->len);
+  g_ptr_array_add (info->sockets, g_object_ref (socket));
+
+  value = g_strdup_printf ("%u", info->sockets->len);
+  g_subprocess_launcher_setenv (launcher, "LISTEN_FDS", value, TRUE);
+  g_free (value);
+}
+
+/*
+ * Defers spawning @launcher until the first connection arrives on one
+ * of its sockets. Only the service knows whether it still has clients,
+ * so it decides when it is idle: if @idle_timeout is non-zero, it is
+ * passed as GB_SUPERVISOR_IDLE_TIMEOUT, in seconds, and the service
+ * should exit on its own once it has had no work for that long. The
+ * next connection starts it again.
+ */
+void
+gb_supervisor_set_on_demand (GbSupervisor        *supervisor,
+                             GSubprocessLauncher *launcher,
+                             gboolean             on_demand,
+                             guint                idle_timeout)
+{
+  GbLauncherInfo *info;
+  gchar *value;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
+
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+  info->on_demand = !!on_demand;
+
+  if (on_demand && idle_timeout)
+    {
+      value = g_strdup_printf ("%u", idle_timeout);
+      g_subprocess_launcher_setenv (launcher,
+                                    "GB_SUPERVISOR_IDLE_TIMEOUT",
+                                    value,
+                                    TRUE);
+      g_free (value);
+    }
+  else
+    {
+      g_subprocess_launcher_unsetenv (launcher, "GB_SUPERVISOR_IDLE_TIMEOUT");
+    }
+
+  if (!on_demand)
+    gb_launcher_info_disarm (info);
+}
+
+/*
+ * Captures stdout and stderr of processes spawned from @launcher into
+ * @path, tagged with the pid of the writer whenever it changes. Data is
+ * moved with splice() so it never passes through our address space. The
+ * file is rotated to @path.1 .. @path.@n_files once it grows past
+ * @max_size bytes; zero disables rotation. A %NULL @path stops
+ * capturing. Processes that are already running keep writing to the
+ * previous file until they exit. The launcher must not use any of the
+ * STDOUT or STDERR flags.
+ *
+ * Capturing cannot be combined with gb_supervisor_set_grace_period().
+ * The read ends of the pipes live in this process, so children left
+ * behind in the grace period would die of SIGPIPE on their next write.
+ */
+gboolean
+gb_supervisor_set_log_file (GbSupervisor         *supervisor,
+                            GSubprocessLauncher  *launcher,
+                            const gchar          *path,
+                            guint64               max_size,
+                            guint                 n_files,
+                            GError              **error)
+{
+  GbLauncherInfo *info;
+  GbLogFile *log = NULL;
+
+  g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), FALSE);
+  g_return_val_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher), FALSE);
+
+  if (path && supervisor->priv->grace_period)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   _("Output capture cannot be combined with a grace "
+                     "period."));
+      return FALSE;
+    }
+
+  if (path && !(log = gb_log_file_new (path, max_size, n_files, error)))
+    return FALSE;
+
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+  g_clear_pointer (&info->log, gb_log_file_close);
+  info->log = log;
+
+  return TRUE;
+}
+
+/*
+ * Sets how many instances of @launcher are kept running. When running,
+ * extra instances are spawned or the newest ones are sent SIGTERM.
+ */
+void
+gb_supervisor_set_instances (GbSupervisor        *supervisor,
+                             GSubprocessLauncher *launcher,
+                             guint                n_instances)
+{
+  GbLauncherInfo *info;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
+
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+  info->n_instances = n_instances;
+
+  if (supervisor->priv->running && info->argv && !info->on_demand)
+    gb_supervisor_scale (supervisor, info, n_instances);
+}
+
+/*
+ * When @notify_ready is set, instances of @launcher are only considered
+ * ready once they send READY=1 to $NOTIFY_SOCKET, as with sd_notify().
+ */
+gboolean
+gb_supervisor_set_notify_ready (GbSupervisor         *supervisor,
+                                GSubprocessLauncher  *launcher,
+                                gboolean              notify_ready,
+                                GError              **error)
+{
+  GbLauncherInfo *info;
+
+  g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), FALSE);
+  g_return_val_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher), FALSE);
+
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+
+  if (notify_ready)
+    {
+      if (!gb_supervisor_ensure_notify (supervisor, error))
+        return FALSE;
+
+      g_subprocess_launcher_setenv (launcher,
+                                    "NOTIFY_SOCKET",
+                                    supervisor->priv->notify_path,
+                                    TRUE);
+    }
+  else if (!info->scale_handler && !info->n_standby)
+    {
+      g_subprocess_launcher_unsetenv (launcher, "NOTIFY_SOCKET");
+    }
+
+  info->notify_ready = !!notify_ready;
+
+  return TRUE;
+}
+
+/*
+ * Keeps @n_standby initialized spares of @launcher parked next to its
+ * instances. A spare is started with GB_SUPERVISOR_STANDBY=1, must send
+ * READY=1 to $NOTIFY_SOCKET once initialized and then wait for SIGUSR1.
+ * When an instance exits unexpectedly, or more instances are needed, a
+ * ready spare is promoted with SIGUSR1 and another one is started in its
+ * place.
+ */
+gboolean
+gb_supervisor_set_standby (GbSupervisor         *supervisor,
+                           GSubprocessLauncher  *launcher,
+                           guint                 n_standby,
+                           GError              **error)
+{
+  GbLauncherInfo *info;
+  GSubprocess *spare;
+
+  g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), FALSE);
+  g_return_val_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher), FALSE);
+
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+
+  if (n_standby)
+    {
+      if (!gb_supervisor_ensure_notify (supervisor, error))
+        return FALSE;
+
+      g_subprocess_launcher_setenv (launcher,
+                                    "NOTIFY_SOCKET",
+                                    supervisor->priv->notify_path,
+                                    TRUE);
+    }
+
+  info->n_standby = n_standby;
+
+  while (info->standby->len > n_standby)
+    {
+      spare = g_ptr_array_remove_index (info->standby, info->standby->len - 1);
+      g_subprocess_send_signal (spare, SIGTERM);
+    }
+
+  gb_supervisor_fill_standby (supervisor, info);
+
+  return TRUE;
+}
+
+/*
+ * Lets the number of instances of @launcher follow the load they report,
+ * between @min_instances and @max_instances. Workers publish their load,
+ * such as their queue depth, by sending "LOAD=<n>" to $NOTIFY_SOCKET as
+ * with sd_notify(). Enough instances are kept to hold each one at or
+ * below @target_load, and after any change the count does not shrink
+ * again for @cooldown seconds. A @max_instances of zero turns scaling
+ * off and keeps the current count.
+ */
+gboolean
+gb_supervisor_set_scaling (GbSupervisor         *supervisor,
+                           GSubprocessLauncher  *launcher,
+                           guint                 min_instances,
+                           guint                 max_instances,
+                           gdouble               target_load,
+                           guint                 cooldown,
+                           GError              **error)
+{
+  GbLauncherInfo *info;
+
+  g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), FALSE);
+  g_return_val_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher), FALSE);
+  g_return_val_if_fail (min_instances <= max_instances, FALSE);
+  g_return_val_if_fail (!max_instances || target_load > 0.0, FALSE);
+
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+
+  if (info->scale_handler)
+    {
+      g_source_remove (info->scale_handler);
+      info->scale_handler = 0;
+    }
+
+  if (!max_instances)
+    return TRUE;
+
+  if (!gb_supervisor_ensure_notify (supervisor, error))
+    return FALSE;
+
+  g_subprocess_launcher_setenv (launcher,
+                                "NOTIFY_SOCKET",
+                                supervisor->priv->notify_path,
+                                TRUE);
+
+  info->min_instances = min_instances;
+  info->max_instances = max_instances;
+  info->target_load = target_load;
+  info->cooldown = cooldown;
+  info->last_scale = g_get_monotonic_time ();
+  info->n_instances = CLAMP (info->n_instances, min_instances, max_instances);
+  info->scale_handler = g_timeout_add_seconds (1, scale_cb, info);
+
+  return TRUE;
+}
+
+/*
+ * Replaces every running instance of @launcher with a fresh one. Up to
+ * @batch_size instances are replaced per batch, and each old instance
+ * is sent SIGTERM only once its replacement is ready. Starting and
+ * retiring instances together never exceed @max_surge on top of the
+ * configured count. The sockets given with gb_supervisor_add_socket()
+ * stay open in the supervisor the whole time and are inherited by each
+ * new instance, so no connection is refused during the restart. Parked
+ * spares are replaced right away, so a failover during or after the
+ * restart never brings back the old program.
+ */
+void
+gb_supervisor_rolling_restart_async (GbSupervisor        *supervisor,
+                                     GSubprocessLauncher *launcher,
+                                     guint                batch_size,
+                                     guint                max_surge,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  GbRestart *restart;
+  GbLauncherInfo *info;
+  GSubprocess *spare;
+  GTask *task;
+  guint i;
+
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
+
+  task = g_task_new (supervisor, cancellable, callback, user_data);
+
+  info = g_hash_table_lookup (supervisor->priv->launchers, launcher);
+
+  if (!info || !info->argv || !supervisor->priv->running)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_NOT_FOUND,
+                               _("The launcher is not running."));
+      g_object_unref (task);
+      return;
+    }
+
+  restart = g_slice_new0 (GbRestart);
+  restart->info = info;
+  restart->starting = g_ptr_array_new_with_free_func (g_object_unref);
+  restart->retiring = g_ptr_array_new_with_free_func (g_object_unref);
+  restart->batch_size = MAX (batch_size, 1);
+  restart->max_surge = MAX (max_surge, 1);
+
+  for (i = 0; i < info->instances->len; i++)
+    g_queue_push_tail (&restart->old,
+                       g_object_ref (g_ptr_array_index (info->instances, i)));
+
+  while (info->standby->len)
+    {
+      spare = g_ptr_array_remove_index (info->standby, info->standby->len - 1);
+      g_subprocess_send_signal (spare, SIGTERM);
+    }
+
+  gb_supervisor_fill_standby (supervisor, info);
+
+  g_task_set_task_data (task, restart, (GDestroyNotify)gb_supervisor_restart_free);
+  g_ptr_array_add (supervisor->priv->restarts, task);
+
+  /*
+   * A restart waiting on readiness may see no child events for a long
+   * time, so react to cancellation directly.
+   */
+  if (cancellable)
+    {
+      restart->cancel_source = g_cancellable_source_new (cancellable);
+      g_source_set_callback (restart->cancel_source,
+                             (GSourceFunc)restart_cancelled_cb,
+                             task,
+                             NULL);
+      g_source_attach (restart->cancel_source, NULL);
+    }
+
+  gb_supervisor_restart_step (supervisor, task);
+}
+
+gboolean
+gb_supervisor_rolling_restart_finish (GbSupervisor  *supervisor,
+                                      GAsyncResult  *result,
+                                      GError       **error)
+{
+  g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, supervisor), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/*
+ * Sets how processes spawned from @launcher are pinned to cpus. @cpuset
+ * is a cpulist such as "0-3,8" and is only used with
+ * GB_SUPERVISOR_PLACEMENT_CPUSET. The topology is read from sysfs the
+ * first time it is needed. Children pin themselves before exec through
+ * a child setup function installed on @launcher, which replaces any set
+ * with g_subprocess_launcher_set_child_setup(); use
+ * gb_supervisor_set_child_setup() instead.
+ */
+void
+gb_supervisor_set_placement (GbSupervisor          *supervisor,
+                             GSubprocessLauncher   *launcher,
+                             GbSupervisorPlacement  placement,
+                             const gchar           *cpuset)
+{
+  GbLauncherInfo *info;
 
-  g_return_if_fail (G_IS_SUBPROCESS (child));
   g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
+  g_return_if_fail (placement <= GB_SUPERVISOR_PLACEMENT_CPUSET);
+  g_return_if_fail (placement != GB_SUPERVISOR_PLACEMENT_CPUSET || cpuset);
 
-  ret = g_subprocess_wait_finish (child, result, &error);
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+  info->placement = placement;
 
-  if (!ret)
-    {
-      g_warning ("%s", error->message);
-      g_error_free (error);
-    }
+  g_clear_pointer (&info->cpuset, (GDestroyNotify)g_array_unref);
 
-  identifier = g_object_get_data (G_OBJECT (child), "identifier");
-  command = g_strdup_printf ("r %s", identifier);
+  if (placement == GB_SUPERVISOR_PLACEMENT_CPUSET)
+    info->cpuset = gb_cpu_topology_parse_list (cpuset);
+}
+
+/*
+ * Sets a resource limit for processes spawned from @launcher. Zero
+ * removes the limit. The memory and cpu limits need a delegated cgroup2
+ * subtree, in which case every child gets a cgroup of its own next to
+ * ours and GbSupervisor::oom-killed is emitted when the kernel kills
+ * inside it.
+ *
+ * Children set their rlimits and join their cgroup before exec, through
+ * a child setup function installed on @launcher. That replaces any child
+ * setup set with g_subprocess_launcher_set_child_setup(), without
+ * warning; use gb_supervisor_set_child_setup() to add your own.
+ *
+ * Units are bytes for AS, MEMORY_MAX and MEMORY_HIGH, seconds for CPU,
+ * descriptors for NOFILE and percent of one cpu for CPU_MAX.
+ */
+void
+gb_supervisor_set_limit (GbSupervisor        *supervisor,
+                         GSubprocessLauncher *launcher,
+                         GbSupervisorLimit    limit,
+                         guint64              value)
+{
+  GbLauncherInfo *info;
 
-  gb_supervisor_send_command (supervisor, command);
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
+  g_return_if_fail (limit < N_LIMITS);
 
-  g_free (command);
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+  info->limits[limit] = value;
 }
 
-static void
-gb_supervisor_launch (GbSupervisor        *supervisor,
-                      GSubprocessLauncher *launcher,
-                      const gchar *const  *argv)
+/*
+ * Sets a function to run in processes spawned from @launcher right
+ * before exec, after they joined their cgroup. It replaces the child
+ * setup of @launcher itself, which the supervisor needs for that.
+ */
+void
+gb_supervisor_set_child_setup (GbSupervisor         *supervisor,
+                               GSubprocessLauncher  *launcher,
+                               GSpawnChildSetupFunc  child_setup,
+                               gpointer              user_data,
+                               GDestroyNotify        destroy_notify)
 {
-  GSubprocess *child;
-  const gchar *identifier;
-  GError *error = NULL;
-  gchar *command;
+  GbLauncherInfo *info;
 
   g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
 
-  child = g_subprocess_launcher_spawnv (launcher, argv, &error);
-
-  if (!child)
-    {
-      g_warning ("%s", error->message);
-      g_error_free (error);
-      return;
-    }
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
 
-  identifier = g_subprocess_get_identifier (child);
+  if (info->child_setup_destroy)
+    info->child_setup_destroy (info->child_setup_data);
 
-  g_object_set_data_full (G_OBJECT (child),
-                          "identifier",
-                          g_strdup (identifier),
-                          g_free);
+  info->child_setup = child_setup;
+  info->child_setup_data = user_data;
+  info->child_setup_destroy = destroy_notify;
 
-  g_object_set_data_full (G_OBJECT (child),
-                          "launcher",
-                          g_object_ref (launcher),
-                          g_object_unref);
+  g_subprocess_launcher_set_child_setup (launcher,
+                                         gb_supervisor_child_setup,
+                                         info,
+                                         NULL);
+  info->child_setup_installed = TRUE;
+}
 
-  command = g_strdup_printf ("a %s", identifier);
-  gb_supervisor_send_command (supervisor, command);
-  g_free (command);
+/*
+ * Sets the priority class used to pick which children to shed under
+ * memory pressure. Lower classes go first; critical children are never
+ * shed.
+ */
+void
+gb_supervisor_set_priority (GbSupervisor         *supervisor,
+                            GSubprocessLauncher  *launcher,
+                            GbSupervisorPriority  priority)
+{
+  GbLauncherInfo *info;
 
-  g_subprocess_wait_async (child,
-                           NULL,
-                           wait_cb,
-                           g_object_ref (supervisor));
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
 
-  g_object_unref (child);
+  info = gb_supervisor_get_launcher_info (supervisor, launcher);
+  info->priority = priority;
 }
 
+/*
+ * Registers a PSI trigger that fires when tasks stall on memory for
+ * @stall_usec within any @window_usec. Each time it fires, the lowest
+ * priority child is frozen or terminated according to @action. Once the
+ * ten second average drops below half the trigger ratio, shed children
+ * are thawed or relaunched one per second, highest priority first.
+ *
+ * The trigger is placed on memory.pressure of our cgroup if limits have
+ * delegated one, otherwise on /proc/pressure/memory.
+ */
 gboolean
-gb_supervisor_run (GbSupervisor *supervisor,
-                   GError      **error)
+gb_supervisor_set_memory_pressure (GbSupervisor                *supervisor,
+                                   GbSupervisorPressureAction   action,
+                                   guint                        stall_usec,
+                                   guint                        window_usec,
+                                   GError                     **error)
 {
   GbSupervisorPrivate *priv;
-  GIOChannel *channel;
-  GIOStatus status;
-  GString *str;
-  GArray *array;
-  gchar *name;
-  gchar mode;
-  GPid pid;
-  gint pipefds[2];
-  gint ret;
-  gint i;
+  gchar *trigger;
+  gssize len;
 
   g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), FALSE);
+  g_return_val_if_fail (action <= GB_SUPERVISOR_PRESSURE_TERMINATE, FALSE);
+  g_return_val_if_fail (stall_usec < window_usec, FALSE);
 
   priv = supervisor->priv;
 
-  /*
-   * Make a pipe that we can use to detect the parent process has
-   * exited.
-   */
-  errno = 0;
-  ret = pipe (pipefds);
+  gb_supervisor_clear_pressure (supervisor);
 
-  if (ret != 0)
+  priv->pressure_action = action;
+
+  if (action == GB_SUPERVISOR_PRESSURE_NONE)
+    return TRUE;
+
+  if (priv->cgroup_root)
+    priv->pressure_path = g_build_filename (priv->cgroup_root,
+                                            "memory.pressure",
+                                            NULL);
+  else
+    priv->pressure_path = g_strdup ("/proc/pressure/memory");
+
+  priv->pressure_restore = 50.0 * stall_usec / window_usec;
+  priv->pressure_fd = open (priv->pressure_path,
+                            O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+  if (priv->pressure_fd == -1)
     {
       g_set_error (error,
                    G_FILE_ERROR,
-                   G_FILE_ERROR_IO,
-                   strerror (errno));
+                   g_file_error_from_errno (errno),
+                   "%s: %s", priv->pressure_path, g_strerror (errno));
+      gb_supervisor_clear_pressure (supervisor);
       return FALSE;
     }
 
-  /*
-   * Fork a child process that will do the monitoring.
-   */
-  errno = 0;
-  pid = fork ();
+  trigger = g_strdup_printf ("some %u %u", stall_usec, window_usec);
+  len = strlen (trigger) + 1;
 
-  if (pid == -1)
+  if (write (priv->pressure_fd, trigger, len) != len)
     {
       g_set_error (error,
                    G_FILE_ERROR,
-                   G_FILE_ERROR_IO,
-                   strerror (errno));
-      close (pipefds[0]);
-      close (pipefds[1]);
+                   g_file_error_from_errno (errno),
+                   "%s: %s", priv->pressure_path, g_strerror (errno));
+      g_free (trigger);
+      gb_supervisor_clear_pressure (supervisor);
       return FALSE;
     }
 
-  /*
-   * If we are the parent process, setup our communication channel
-   * and then we are done.
-   */
-  if (pid)
-    {
-      GHashTableIter iter;
-      gpointer key;
-      gpointer value;
-      gchar *command;
-
-      priv->pid = pid;
-
-      priv->channel = g_io_channel_unix_new (pipefds[1]);
-      g_io_channel_set_close_on_unref (priv->channel, TRUE);
-
-      close (pipefds[0]);
+  g_free (trigger);
 
-      priv->running = TRUE;
+  priv->pressure_handler = g_unix_fd_add (priv->pressure_fd,
+                                          G_IO_PRI | G_IO_ERR,
+                                          pressure_cb,
+                                          supervisor);
 
-      g_hash_table_iter_init (&iter, priv->launchers);
-      while (g_hash_table_iter_next (&iter, &key, &value))
-        {
-          gb_supervisor_launch (supervisor, key, value);
-        }
+  return TRUE;
+}
 
-      for (i = 0; i < priv->pids->len; i++)
-        {
-          pid = g_array_index (priv->pids, GPid, i);
-          command = g_strdup_printf ("a %u", (guint)pid);
-          gb_supervisor_send_command (supervisor, command);
-          g_free (command);
-        }
+static gboolean
+gb_supervisor_captures_output (GbSupervisor *supervisor)
+{
+  GHashTableIter iter;
+  gpointer value;
 
-      return TRUE;
+  g_hash_table_iter_init (&iter, supervisor->priv->launchers);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      if (((GbLauncherInfo *)value)->log)
+        return TRUE;
     }
 
-  /*
-   * Rename the process to make it easier to find in `top'.
-   */
-  name = g_strdup_printf ("%s-supervisor", g_get_prgname ());
-  g_set_prgname (name);
-  g_free (name);
-
-  /*
-   * TODO: Close all file-descriptors except pipefds[0].
-   */
-  close (pipefds[1]);
+  return FALSE;
+}
 
-  channel = g_io_channel_unix_new (pipefds[0]);
-  g_io_channel_set_close_on_unref (channel, TRUE);
+/*
+ * Opts into grace mode. If this process goes away without calling
+ * gb_supervisor_shutdown(), its children are kept alive for @seconds
+ * while the supervisor waits on sockets named after @name in
+ * $XDG_RUNTIME_DIR. A new process using the same @name may take them
+ * over with gb_supervisor_reattach(). Must be called before
+ * gb_supervisor_run(), and not for a supervisor capturing output with
+ * gb_supervisor_set_log_file().
+ */
+void
+gb_supervisor_set_grace_period (GbSupervisor *supervisor,
+                                const gchar  *name,
+                                guint         seconds)
+{
+  GbSupervisorPrivate *priv;
 
-  str = g_string_new (NULL);
-  array = g_array_new (FALSE, FALSE, sizeof (GPid));
+  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+  g_return_if_fail (name);
+  g_return_if_fail (!strchr (name, G_DIR_SEPARATOR));
+  g_return_if_fail (!supervisor->priv->running);
+  g_return_if_fail (!seconds || !gb_supervisor_captures_output (supervisor));
 
-again:
-  status = g_io_channel_read_line_string (channel, str, NULL, NULL);
+  priv = supervisor->priv;
 
-  if (status != G_IO_STATUS_NORMAL)
-    {
-      goto kill_targets;
-    }
+  g_free (priv->grace_name);
+  priv->grace_name = g_strdup (name);
+  priv->grace_period = seconds;
+}
 
-  if (2 != sscanf (str->str, "%c %u", &mode, &pid))
+/*
+ * Use instead of gb_supervisor_run() to take over the children of a
+ * previous process that used the same grace period name and went away
+ * less than the grace period ago. GbSupervisor::reattached is emitted
+ * for every child still alive, with a pidfd that stays valid until the
+ * child exits. Fails with G_IO_ERROR_NOT_FOUND if nobody is waiting.
+ *
+ * Children spawned from a launcher with the same argv as one added
+ * before this call count as its instances, and only the missing ones
+ * are spawned. They are not part of gb_supervisor_rolling_restart().
+ */
+/*
+ * Counts reattached children toward the instances of the launcher they
+ * were spawned from, so starting up only fills the gaps. Parked spares
+ * cannot be taken over, since their launcher keeps the list of spares,
+ * and are retired; new ones are parked in their place.
+ */
+static void
+gb_supervisor_adopt (GbSupervisor *supervisor)
+{
+  GbSupervisorPrivate *priv = supervisor->priv;
+  GHashTableIter children;
+  GHashTableIter launchers;
+  GbReattached *child;
+  GbLauncherInfo *info;
+  gpointer value;
+
+  g_hash_table_iter_init (&children, priv->reattached);
+  while (g_hash_table_iter_next (&children, NULL, &value))
     {
-      goto kill_targets;
-    }
+      child = value;
 
-  switch (mode) {
-    case 'a':
-      g_array_append_val (array, pid);
-      break;
-    case 'r':
+      if (!child->tag)
+        continue;
 
-      for (i = 0; i < array->len; i++)
+      g_hash_table_iter_init (&launchers, priv->launchers);
+      while (g_hash_table_iter_next (&launchers, NULL, &value))
         {
-          if (g_array_index (array, GPid, i) == pid)
-            {
-              g_array_remove_index_fast (array, i);
-              break;
-            }
-        }
-      break;
-    default:
-      goto kill_targets;
-    }
+          info = value;
 
-  goto again;
+          if (!info->argv || info->on_demand || info->tag != (child->tag >> 1))
+            continue;
 
-kill_targets:
+          if (child->tag & 1)
+            {
+              kill (child->pid, SIGTERM);
+            }
+          else
+            {
+              child->info = info;
+              info->n_adopted++;
+            }
 
-  for (i = 0; i < array->len; i++)
-    {
-      pid = g_array_index (array, GPid, i);
-      g_printerr ("Reaping %u\n", (guint)pid);
-      kill (pid, SIGTERM);
+          break;
+        }
     }
-
-  exit (EXIT_SUCCESS);
-
-  return TRUE;
 }
 
-void
-gb_supervisor_add_pid (GbSupervisor *supervisor,
-                       GPid          pid)
+gboolean
+gb_supervisor_reattach (GbSupervisor  *supervisor,
+                        GError       **error)
 {
   GbSupervisorPrivate *priv;
-  gchar *command;
+  struct sockaddr_un addr = { 0 };
+  gchar *path;
+  guint shard;
+  gint fd;
 
-  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
-  g_return_if_fail (pid);
+  g_return_val_if_fail (GB_IS_SUPERVISOR (supervisor), FALSE);
+  g_return_val_if_fail (supervisor->priv->grace_name, FALSE);
+  g_return_val_if_fail (!supervisor->priv->running, FALSE);
 
   priv = supervisor->priv;
 
-  if (priv->running)
+  addr.sun_family = AF_UNIX;
+
+  for (shard = 0; ; shard++)
     {
-      command = g_strdup_printf ("a %u", (guint)pid);
-      gb_supervisor_send_command (supervisor, command);
-      g_free (command);
-    } else{
-      g_array_append_val (priv->pids, pid);
-    }
-}
+      path = gb_supervisor_get_grace_path (supervisor, shard);
 
-void
-gb_supervisor_add_subprocess (GbSupervisor *supervisor,
-                              GSubprocess  *subprocess)
-{
-  const gchar *identifier;
-  guint64 val;
+      if (strlen (path) >= sizeof addr.sun_path)
+        {
+          g_free (path);
+          break;
+        }
 
-  g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
+      strcpy (addr.sun_path, path);
+      g_free (path);
 
-  identifier = g_subprocess_get_identifier (subprocess);
+      fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
 
-  if (1 == sscanf (identifier, "%"G_GUINT64_FORMAT, &val))
+      if (fd == -1)
+        break;
+
+      if (connect (fd, (struct sockaddr *)&addr, sizeof addr) != 0)
+        {
+          close (fd);
+          break;
+        }
+
+      priv->reattached_channels = TRUE;
+      gb_supervisor_add_channel (supervisor, fd);
+
+      if (!gb_supervisor_receive_children (supervisor, fd, error))
+        {
+          /*
+           * Closing the channels sends the shards back to waiting out
+           * the grace period.
+           */
+          g_ptr_array_set_size (priv->channels, 0);
+          g_hash_table_remove_all (priv->reattached);
+          priv->reattached_channels = FALSE;
+          return FALSE;
+        }
+    }
+
+  if (!shard)
     {
-      gb_supervisor_add_pid (supervisor, (GPid)val);
-    } else{
-      g_warning ("Failed to parse pid %s", identifier);
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_FOUND,
+                   _("No supervisor is waiting to be reattached."));
+      return FALSE;
     }
-}
 
-static void
-gb_supervisor_dispose (GObject *object)
-{
-  GbSupervisorPrivate *priv = GB_SUPERVISOR (object)->priv;
+  /*
+   * Pids only hash to the shard holding them while the shard count
+   * stays the same.
+   */
+  priv->n_shards = shard;
 
-  g_clear_pointer (&priv->launchers, (GDestroyNotify)g_hash_table_unref);
+  gb_supervisor_adopt (supervisor);
+  gb_supervisor_attach (supervisor);
 
-  G_OBJECT_CLASS (gb_supervisor_parent_class)->dispose (object);
+  return TRUE;
 }
 
+/*
+ * Sets how many supervisor processes share the pids. Each shard has its
+ * own channel and pid table, and a pid is always routed to the same
+ * shard. Must be called before gb_supervisor_run().
+ */
 void
-gb_supervisor_add_launcher (GbSupervisor        *supervisor,
-                            GSubprocessLauncher *launcher,
-                            const gchar *const  *argv)
+gb_supervisor_set_shards (GbSupervisor *supervisor,
+                          guint         n_shards)
 {
-  GbSupervisorPrivate *priv;
-
   g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
-  g_return_if_fail (G_IS_SUBPROCESS_LAUNCHER (launcher));
+  g_return_if_fail (n_shards > 0);
+  g_return_if_fail (!supervisor->priv->running);
 
-  priv = supervisor->priv;
-
-  g_hash_table_insert (priv->launchers,
-                       g_object_ref (launcher),
-                       g_strdupv ((gchar **)argv));
-
-  if (priv->running)
-    {
-      gb_supervisor_launch (supervisor, launcher, argv);
-    }
+  supervisor->priv->n_shards = n_shards;
 }
 
 void
 gb_supervisor_shutdown (GbSupervisor *supervisor)
 {
   GbSupervisorPrivate *priv;
+  GList *link;
+  GList *next;
+  GPid pid;
+  guint i;
 
   g_return_if_fail (GB_IS_SUPERVISOR (supervisor));
 
+  priv = supervisor->priv;
+
   /*
-   * TODO: Close parent fd, cause child to cleanup.
+   * Thaw whatever memory pressure froze, so those children get a
+   * SIGTERM they can act on like everyone else.
    */
+  for (link = priv->shed.head; link; link = next)
+    {
+      next = link->next;
 
-  priv = supervisor->priv;
+      if (GPOINTER_TO_INT (g_object_get_data (link->data, "shed")) ==
+          GB_SUPERVISOR_PRESSURE_FREEZE)
+        {
+          gb_supervisor_thaw (supervisor, link->data);
+          g_object_unref (link->data);
+          g_queue_delete_link (&priv->shed, link);
+        }
+    }
+
+  /*
+   * Tell every shard this is deliberate so none waits out a grace
+   * period, then close every channel before waiting on any shard so
+   * they all reap their pids at the same time.
+   */
+  for (i = 0; i < priv->channels->len; i++)
+    gb_supervisor_write (supervisor,
+                         g_ptr_array_index (priv->channels, i),
+                         "q 0\n", 4);
+
+  g_ptr_array_set_size (priv->channels, 0);
+  g_hash_table_remove_all (priv->reattached);
+
+  for (i = 0; i < priv->shards->len; i++)
+    {
+      pid = g_array_index (priv->shards, GPid, i);
+      while (waitpid (pid, NULL, 0) == -1 && errno == EINTR)
+        ;
+    }
 
-  g_clear_pointer (&priv->channel, (GDestroyNotify)g_io_channel_unref);
+  g_array_set_size (priv->shards, 0);
 
   priv->running = FALSE;
 }
@@ -396,8 +3505,12 @@ gb_supervisor_finalize (GObject *object)
   GbSupervisorPrivate *priv = GB_SUPERVISOR (object)->priv;
 
   g_clear_pointer (&priv->pids, (GDestroyNotify)g_array_unref);
-  g_clear_pointer (&priv->channel, (GDestroyNotify)g_io_channel_unref);
+  g_clear_pointer (&priv->channels, (GDestroyNotify)g_ptr_array_unref);
+  g_clear_pointer (&priv->shards, (GDestroyNotify)g_array_unref);
   g_clear_pointer (&priv->launchers, (GDestroyNotify)g_hash_table_unref);
+  g_clear_pointer (&priv->topology, gb_cpu_topology_free);
+  g_clear_pointer (&priv->cgroup_root, g_free);
+  g_clear_pointer (&priv->grace_name, g_free);
 
   G_OBJECT_CLASS (gb_supervisor_parent_class)->finalize (object);
 }
@@ -410,6 +3523,36 @@ gb_supervisor_class_init (GbSupervisorClass *klass)
   object_class = G_OBJECT_CLASS (klass);
   object_class->dispose = gb_supervisor_dispose;
   object_class->finalize = gb_supervisor_finalize;
+
+  gSignals[OOM_KILLED] =
+    g_signal_new ("oom-killed",
+                  GB_TYPE_SUPERVISOR,
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL,
+                  NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  2,
+                  G_TYPE_SUBPROCESS_LAUNCHER,
+                  G_TYPE_SUBPROCESS);
+
+  /*
+   * Emitted by gb_supervisor_reattach() with the pid and pidfd of each
+   * child taken over from a previous process.
+   */
+  gSignals[REATTACHED] =
+    g_signal_new ("reattached",
+                  GB_TYPE_SUPERVISOR,
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL,
+                  NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  2,
+                  G_TYPE_INT,
+                  G_TYPE_INT);
 }
 
 static void
@@ -418,10 +3561,30 @@ gb_supervisor_init (GbSupervisor *supervisor)
   supervisor->priv = gb_supervisor_get_instance_private (supervisor);
 
   supervisor->priv->pids = g_array_new (FALSE, FALSE, sizeof (GPid));
+  supervisor->priv->procs_fd = -1;
+  supervisor->priv->shards = g_array_new (FALSE, FALSE, sizeof (GPid));
+  supervisor->priv->n_shards = 1;
+  supervisor->priv->channels =
+    g_ptr_array_new_with_free_func ((GDestroyNotify)g_io_channel_unref);
+  supervisor->priv->pressure_fd = -1;
+  supervisor->priv->notify_fd = -1;
+  supervisor->priv->restarts = g_ptr_array_new_with_free_func (g_object_unref);
+
+  supervisor->priv->children =
+    g_hash_table_new_full (g_direct_hash,
+                           g_direct_equal,
+                           NULL,
+                           g_object_unref);
 
   supervisor->priv->launchers =
     g_hash_table_new_full (g_direct_hash,
                            g_direct_equal,
                            g_object_unref,
-                           (GDestroyNotify)g_strfreev);
+                           (GDestroyNotify)gb_launcher_info_free);
+
+  supervisor->priv->reattached =
+    g_hash_table_new_full (g_direct_hash,
+                           g_direct_equal,
+                           NULL,
+                           (GDestroyNotify)gb_reattached_free);
 }
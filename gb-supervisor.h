@@ -31,6 +31,41 @@ G_BEGIN_DECLS
 #define GB_IS_SUPERVISOR_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GB_TYPE_SUPERVISOR))
 #define GB_SUPERVISOR_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GB_TYPE_SUPERVISOR, GbSupervisorClass))
 
+typedef enum
+{
+  GB_SUPERVISOR_PLACEMENT_NONE,
+  GB_SUPERVISOR_PLACEMENT_ROUND_ROBIN,
+  GB_SUPERVISOR_PLACEMENT_PACK_L3,
+  GB_SUPERVISOR_PLACEMENT_SPREAD_NUMA,
+  GB_SUPERVISOR_PLACEMENT_CPUSET,
+} GbSupervisorPlacement;
+
+typedef enum
+{
+  GB_SUPERVISOR_LIMIT_AS,
+  GB_SUPERVISOR_LIMIT_NOFILE,
+  GB_SUPERVISOR_LIMIT_CPU,
+  GB_SUPERVISOR_LIMIT_MEMORY_MAX,
+  GB_SUPERVISOR_LIMIT_MEMORY_HIGH,
+  GB_SUPERVISOR_LIMIT_CPU_MAX,
+} GbSupervisorLimit;
+
+typedef enum
+{
+  GB_SUPERVISOR_PRIORITY_BACKGROUND = -2,
+  GB_SUPERVISOR_PRIORITY_LOW        = -1,
+  GB_SUPERVISOR_PRIORITY_NORMAL     =  0,
+  GB_SUPERVISOR_PRIORITY_HIGH       =  1,
+  GB_SUPERVISOR_PRIORITY_CRITICAL   =  2,
+} GbSupervisorPriority;
+
+typedef enum
+{
+  GB_SUPERVISOR_PRESSURE_NONE,
+  GB_SUPERVISOR_PRESSURE_FREEZE,
+  GB_SUPERVISOR_PRESSURE_TERMINATE,
+} GbSupervisorPressureAction;
+
 typedef struct _GbSupervisor        GbSupervisor;
 typedef struct _GbSupervisorClass   GbSupervisorClass;
 typedef struct _GbSupervisorPrivate GbSupervisorPrivate;
@@ -53,12 +88,96 @@ void          gb_supervisor_add_launcher   (GbSupervisor         *supervisor,
                                             const gchar * const  *argv);
 void          gb_supervisor_add_pid        (GbSupervisor         *supervisor,
                                             GPid                  pid);
+void          gb_supervisor_add_pids       (GbSupervisor         *supervisor,
+                                            const GPid           *pids,
+                                            guint                 n_pids);
+void          gb_supervisor_add_socket     (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            GSocket              *socket);
 void          gb_supervisor_add_subprocess (GbSupervisor         *supervisor,
                                             GSubprocess          *subprocess);
 GType         gb_supervisor_get_type       (void) G_GNUC_CONST;
 GbSupervisor *gb_supervisor_new            (void);
+gboolean      gb_supervisor_reattach       (GbSupervisor         *supervisor,
+                                            GError              **error);
+void          gb_supervisor_remove_pid     (GbSupervisor         *supervisor,
+                                            GPid                  pid);
+void          gb_supervisor_remove_pids    (GbSupervisor         *supervisor,
+                                            const GPid           *pids,
+                                            guint                 n_pids);
+void          gb_supervisor_rolling_restart_async
+                                           (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            guint                 batch_size,
+                                            guint                 max_surge,
+                                            GCancellable         *cancellable,
+                                            GAsyncReadyCallback   callback,
+                                            gpointer              user_data);
+gboolean      gb_supervisor_rolling_restart_finish
+                                           (GbSupervisor         *supervisor,
+                                            GAsyncResult         *result,
+                                            GError              **error);
 gboolean      gb_supervisor_run            (GbSupervisor         *supervisor,
                                             GError              **error);
+void          gb_supervisor_set_child_setup
+                                           (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            GSpawnChildSetupFunc  child_setup,
+                                            gpointer              user_data,
+                                            GDestroyNotify        destroy_notify);
+void          gb_supervisor_set_grace_period
+                                           (GbSupervisor         *supervisor,
+                                            const gchar          *name,
+                                            guint                 seconds);
+void          gb_supervisor_set_instances  (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            guint                 n_instances);
+void          gb_supervisor_set_limit      (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            GbSupervisorLimit     limit,
+                                            guint64               value);
+gboolean      gb_supervisor_set_log_file   (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            const gchar          *path,
+                                            guint64               max_size,
+                                            guint                 n_files,
+                                            GError              **error);
+gboolean      gb_supervisor_set_memory_pressure
+                                           (GbSupervisor         *supervisor,
+                                            GbSupervisorPressureAction
+                                                                  action,
+                                            guint                 stall_usec,
+                                            guint                 window_usec,
+                                            GError              **error);
+gboolean      gb_supervisor_set_notify_ready
+                                           (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            gboolean              notify_ready,
+                                            GError              **error);
+void          gb_supervisor_set_on_demand  (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            gboolean              on_demand,
+                                            guint                 idle_timeout);
+void          gb_supervisor_set_placement  (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            GbSupervisorPlacement placement,
+                                            const gchar          *cpuset);
+void          gb_supervisor_set_priority   (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            GbSupervisorPriority  priority);
+gboolean      gb_supervisor_set_scaling    (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            guint                 min_instances,
+                                            guint                 max_instances,
+                                            gdouble               target_load,
+                                            guint                 cooldown,
+                                            GError              **error);
+void          gb_supervisor_set_shards     (GbSupervisor         *supervisor,
+                                            guint                 n_shards);
+gboolean      gb_supervisor_set_standby    (GbSupervisor         *supervisor,
+                                            GSubprocessLauncher  *launcher,
+                                            guint                 n_standby,
+                                            GError              **error);
 void          gb_supervisor_shutdown       (GbSupervisor         *supervisor);
 
 G_END_DECLS